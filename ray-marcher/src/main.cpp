@@ -1,8 +1,77 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "ofAppNoWindow.h"
+
+// Command line options for a headless render.  With no arguments the app
+// opens its window as usual.
+//
+static void usage(const char *exe) {
+	cout << "usage: " << exe << " [options]" << endl
+		<< "  renders one frame without a window or GL context, saves it and exits" << endl
+		<< endl
+		<< "  --scene <name>      scene to render (repeated-spheres)" << endl
+		<< "  --width <px>        image width (1200)" << endl
+		<< "  --height <px>       image height (800)" << endl
+		<< "  --output <path>     image to write, relative to the data folder (images/image1.png)" << endl
+		<< "  --bench <json>      time the sdf kernels and a fixed size render, write ns / call" << endl
+		<< "                      and Mrays/s to json (relative to the data folder)" << endl;
+}
+
+// Parse argv into the app's render settings.  returns false on a bad or
+// unknown option.
+//
+static bool parseArgs(int argc, char *argv[], ofApp *app) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		std::string value = hasValue ? argv[i + 1] : "";
+
+		if (arg == "--help" || arg == "-h") return false;
+		else if (!hasValue) {
+			cout << "unknown option or missing value: " << arg << endl;
+			return false;
+		}
+		else {
+			i++;
+			if (arg == "--scene") {
+				if (value != "repeated-spheres") {
+					cout << "unknown scene: " << value << endl;
+					return false;
+				}
+			}
+			else if (arg == "--width") app->imageWidth = ofToInt(value);
+			else if (arg == "--height") app->imageHeight = ofToInt(value);
+			else if (arg == "--output") app->path = value;
+			else if (arg == "--bench") app->benchOutput = value;
+			else {
+				cout << "unknown option: " << arg << endl;
+				return false;
+			}
+		}
+	}
+	if (app->imageWidth <= 0 || app->imageHeight <= 0) {
+		cout << "width and height must be positive" << endl;
+		return false;
+	}
+	return true;
+}
 
 //========================================================================
-int main( ){
+int main(int argc, char *argv[]){
+	if (argc > 1) {
+		// headless: no GL context, setup() renders, saves and quits
+		ofAppNoWindow window;
+		ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
+		ofApp *app = new ofApp();
+		if (!parseArgs(argc, argv, app)) {
+			usage(argv[0]);
+			delete app;
+			return 1;
+		}
+		app->headless = true;
+		return ofRunApp(app);
+	}
+
 	ofSetupOpenGL(1024,768,OF_WINDOW);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
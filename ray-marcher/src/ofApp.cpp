@@ -10,7 +10,11 @@ void ofApp::setup(){
 	previewCam.setPosition(glm::vec3(0, 0, 10));
 	previewCam.lookAt(glm::vec3(0, 0, -1));
 
+	// there is no GL context to upload to when headless
+	if (headless) image.setUseTexture(false);
 	image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+
+	if (headless) renderHeadless();
 }
 
 //--------------------------------------------------------------
@@ -118,7 +122,69 @@ void ofApp::rayMarchLoop() {
 			}
 		}
 	}
-	image.save(path, OF_IMAGE_QUALITY_BEST);
+	imageSaver.save(image.getPixels(), path);
+}
+
+// Command line render: march the frame, wait until it is on disk and quit
+//
+void ofApp::renderHeadless() {
+	if (!benchOutput.empty()) {
+		runBenchmark();
+		ofExit(0);
+		return;
+	}
+	cout << "ray marching " << imageWidth << "x" << imageHeight << " -> " << path << endl;
+
+	float start = ofGetElapsedTimef();
+	rayMarchLoop();
+	float rendered = ofGetElapsedTimef();
+	imageSaver.waitIdle();
+	float saved = ofGetElapsedTimef();
+
+	cout << "render: " << rendered - start << "s, save: " << saved - rendered << "s, total: " << saved - start << "s" << endl;
+	ofExit(0);
+}
+
+// --bench: time the sdf() of every shape and opRep() on seeded random
+// points, single marched rays, and the repeated spheres grid at a fixed
+// size.  The scene's rays are the primary rays, one per pixel.
+//
+void ofApp::runBenchmark() {
+	Benchmark bench("ray-marcher");
+	std::mt19937 rng(Benchmark::seed);
+	std::uniform_real_distribution<float> spread(-1, 1);
+
+	const int inputs = 4096;
+	std::vector < glm::vec3 > points;
+	std::vector < Ray > rays;
+	for (int i = 0; i < inputs; i++) {
+		points.push_back(10.0f * glm::vec3(spread(rng), spread(rng), spread(rng)));
+		rays.push_back(renderCam.getRay(.5f + .5f * spread(rng), .5f + .5f * spread(rng)));
+	}
+
+	RoundedCylinder cylinder(glm::vec3(0), .1, .75, 1.5);
+	Plane ground(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0));
+	bench.kernel("Sphere::sdf", false, inputs, [&](int i) { return s1.sdf(points[i]); });
+	bench.kernel("RoundedCylinder::sdf", false, inputs, [&](int i) { return cylinder.sdf(points[i]); });
+	bench.kernel("Plane::sdf", false, inputs, [&](int i) { return ground.sdf(points[i]); });
+	bench.kernel("ofApp::opRep", false, inputs, [&](int i) { return opRep(points[i], glm::vec3(20, 20, 20), &s1); });
+	bench.kernel("ofApp::rayMarch", true, inputs, [&](int i) {
+		glm::vec3 p;
+		return rayMarch(rays[i], p) ? p.z : 0.0f;
+	});
+
+	imageWidth = 600;
+	imageHeight = 400;
+	image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+	float start = ofGetElapsedTimef();
+	rayMarchLoop();
+	float marched = ofGetElapsedTimef();
+	imageSaver.waitIdle();
+	float saved = ofGetElapsedTimef();
+	bench.scene("repeated-spheres", imageWidth, imageHeight, 1, int64_t(imageWidth) * imageHeight,
+		{ { "trace", marched - start }, { "save", saved - marched } });
+
+	if (!bench.write(ofToDataPath(benchOutput))) cout << "can't write " << benchOutput << endl;
 }
 
 bool ofApp::rayMarch(Ray r, glm::vec3 &p) {
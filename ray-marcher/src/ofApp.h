@@ -3,6 +3,9 @@
 #include "ofMain.h"
 #include <glm/gtx/intersect.hpp>
 #include <glm/gtc/noise.hpp>
+#include "ImageSaver.h"
+#include "Benchmark.h"
+#include <random>
 
 class Ray {
 public:
@@ -246,6 +249,8 @@ class ofApp : public ofBaseApp{
 		void dragEvent(ofDragInfo dragInfo);
 		void gotMessage(ofMessage msg);
 		void rayMarchLoop();
+		void renderHeadless();
+		void runBenchmark();
 		bool rayMarch(Ray r, glm::vec3 &p);
 		float sceneSDF(glm::vec3 point);
 		glm::vec3 getNormalRM(const glm::vec3 &p);
@@ -277,6 +282,9 @@ class ofApp : public ofBaseApp{
 		int totalHits, hit1, hit2, hit3;
 
 		ofImage image;
+		ImageSaver imageSaver;   // encodes finished frames in the background
+		bool headless = false;   // command line batch render, no window (see main.cpp)
+		std::string benchOutput; // headless: run the benchmarks and write their results here
 		float imageHeight = 800;
 		float imageWidth = 1200;
 		filesystem::path path = "images/image1.png";
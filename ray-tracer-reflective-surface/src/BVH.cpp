@@ -0,0 +1,303 @@
+#include "BVH.h"
+#include "ofApp.h"
+
+#include <algorithm>
+
+void BVH::build(const std::vector<SceneObject*> &objects) {
+	nodes.clear();
+	prims.clear();
+	unbounded.clear();
+	unboundedPlanes.clear();
+
+	std::vector<BuildPrim> build;
+	for (SceneObject *obj : objects) {
+		BuildPrim prim;
+		prim.obj = obj;
+		PlaneShape plane;
+		if (obj->getBounds(prim.bmin, prim.bmax)) {
+			prim.centroid = (prim.bmin + prim.bmax) * 0.5f;
+			build.push_back(prim);
+		}
+		else if (toPlaneShape(obj, plane)) unboundedPlanes.push_back(plane);
+		else unbounded.push_back(obj);
+	}
+	if (build.empty()) return;
+
+	nodes.reserve(2 * build.size());
+	buildNode(build, 0, build.size());
+
+	// order each leaf spheres, planes, the rest and copy the spheres and
+	// planes to their flat arrays
+	//
+	auto isSphere = [](const BuildPrim &prim) { return dynamic_cast<Sphere*>(prim.obj) != NULL; };
+	auto isPlane = [](const BuildPrim &prim) { PlaneShape shape; return toPlaneShape(prim.obj, shape); };
+	sphereSet.resize(build.size());
+	planeShapes.assign(build.size(), PlaneShape());
+	for (Node &node : nodes) {
+		if (node.count == 0) continue;
+		auto first = build.begin() + node.index;
+		auto last = first + node.count;
+		auto planesEnd = std::stable_partition(first, last, isSphere);
+		node.spheres = planesEnd - first;
+		node.planes = std::stable_partition(planesEnd, last, isPlane) - planesEnd;
+		for (int i = node.index; i < node.index + node.spheres; i++) {
+			Sphere *sphere = (Sphere *)build[i].obj;
+			sphereSet.set(i, sphere->position, sphere->radius);
+		}
+		for (int i = node.index + node.spheres; i < node.index + node.spheres + node.planes; i++) {
+			toPlaneShape(build[i].obj, planeShapes[i]);
+		}
+	}
+	for (BuildPrim &prim : build) prims.push_back(prim.obj);
+}
+
+// split at the median centroid of the widest axis until leaves are small
+//
+int BVH::buildNode(std::vector<BuildPrim> &build, int first, int count) {
+	int nodeIndex = nodes.size();
+	nodes.push_back(Node());
+
+	glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+	glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+	for (int i = first; i < first + count; i++) {
+		bmin = glm::min(bmin, build[i].bmin);
+		bmax = glm::max(bmax, build[i].bmax);
+		cmin = glm::min(cmin, build[i].centroid);
+		cmax = glm::max(cmax, build[i].centroid);
+	}
+	nodes[nodeIndex].bmin = bmin;
+	nodes[nodeIndex].bmax = bmax;
+
+	glm::vec3 extent = cmax - cmin;
+	int axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	// all centroids on top of each other can't be split any further
+	if (count <= leafSize || extent[axis] <= 0) {
+		nodes[nodeIndex].index = first;
+		nodes[nodeIndex].count = count;
+		nodes[nodeIndex].spheres = 0;
+		nodes[nodeIndex].planes = 0;
+		return nodeIndex;
+	}
+
+	int half = count / 2;
+	std::nth_element(build.begin() + first, build.begin() + first + half, build.begin() + first + count,
+		[axis](const BuildPrim &a, const BuildPrim &b) { return a.centroid[axis] < b.centroid[axis]; });
+
+	buildNode(build, first, half);
+	int right = buildNode(build, first + half, count - half);
+	nodes[nodeIndex].index = right;
+	nodes[nodeIndex].count = 0;
+	nodes[nodeIndex].spheres = 0;
+	nodes[nodeIndex].planes = 0;
+	return nodeIndex;
+}
+
+// MirrorPlane repeats Plane's fields rather than using them, so it has to
+// be checked first
+//
+bool BVH::toPlaneShape(SceneObject *obj, PlaneShape &shape) {
+	if (MirrorPlane *mirror = dynamic_cast<MirrorPlane*>(obj)) {
+		shape.normal = mirror->normal;
+		shape.halfWidth = mirror->width / 2;
+		shape.halfHeight = mirror->height / 2;
+	}
+	else if (Plane *plane = dynamic_cast<Plane*>(obj)) {
+		if (dynamic_cast<ViewPlane*>(obj)) return false;
+		shape.normal = plane->normal;
+		shape.halfWidth = plane->width / 2;
+		shape.halfHeight = plane->height / 2;
+	}
+	else return false;
+	planeExtentAxes(shape.normal, shape.u, shape.v);
+	shape.position = obj->position;
+	shape.object = obj;
+	return true;
+}
+
+inline bool BVH::PlaneShape::intersect(const Ray &ray, float tMax, HitRecord &hit) const {
+	float dist;
+	if (!glm::intersectRayPlane(ray.p, ray.d, position, normal, dist) || dist >= tMax) return false;
+	glm::vec3 point = ray.evalPoint(dist);
+	glm::vec3 d = point - position;
+	if (abs(glm::dot(d, u)) >= halfWidth || abs(glm::dot(d, v)) >= halfHeight) return false;
+	hit.t = dist;
+	hit.point = point;
+	hit.normal = normal;
+	hit.object = object;
+	return true;
+}
+
+// slab test, true if the ray enters the box before tMax
+//
+bool BVH::hitBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir, float tMax) {
+	glm::vec3 t0 = (node.bmin - origin) * invDir;
+	glm::vec3 t1 = (node.bmax - origin) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return enter <= exit;
+}
+
+void BVH::intersectUnbounded(const Ray &ray, HitRecord &hit) const {
+	for (const PlaneShape &plane : unboundedPlanes) plane.intersect(ray, hit.t, hit);
+	for (SceneObject *obj : unbounded) obj->intersect(ray, hit.t, hit);
+}
+
+// nearest hit among the objects of a leaf, each kind with its own test
+//
+void BVH::intersectLeaf(const Node &node, const Ray &ray, HitRecord &hit) const {
+	float t;
+	int slot = node.spheres > 0 ? sphereSet.closest(ray, node.index, node.spheres, hit.t, t) : -1;
+	if (slot >= 0) {
+		// point and normal only for the nearest sphere of the leaf
+		hit.t = t;
+		hit.point = ray.evalPoint(t);
+		hit.normal = (hit.point - sphereSet.center(slot)) / sphereSet.radius(slot);
+		hit.object = prims[slot];
+	}
+	int planesEnd = node.index + node.spheres + node.planes;
+	for (int i = node.index + node.spheres; i < planesEnd; i++) planeShapes[i].intersect(ray, hit.t, hit);
+	for (int i = planesEnd; i < node.index + node.count; i++) prims[i]->intersect(ray, hit.t, hit);
+}
+
+bool BVH::closestHit(const Ray &ray, HitRecord &hit, float tMax) const {
+	// every successful intersect() shrinks hit.t, so later candidates and
+	// boxes behind the current nearest hit are rejected early
+	//
+	hit.t = tMax;
+	hit.object = NULL;
+
+	intersectUnbounded(ray, hit);
+
+	if (!nodes.empty()) {
+		glm::vec3 invDir = slabInverse(ray.d);
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node &node = nodes[stack[--top]];
+			if (!hitBox(node, ray.p, invDir, hit.t)) continue;
+			if (node.count > 0) intersectLeaf(node, ray, hit);
+			else {
+				// visit the child nearer the ray origin first so the far one
+				// is more likely to be culled by the shrinking hit.t
+				//
+				int nearChild = &node - &nodes[0] + 1;
+				int farChild = node.index;
+				float dNear = glm::distance2((nodes[nearChild].bmin + nodes[nearChild].bmax) * 0.5f, ray.p);
+				float dFar = glm::distance2((nodes[farChild].bmin + nodes[farChild].bmax) * 0.5f, ray.p);
+				if (dFar < dNear) std::swap(nearChild, farChild);
+				stack[top++] = farChild;
+				stack[top++] = nearChild;
+			}
+		}
+	}
+
+	if (!hit.object) return false;
+	hit.material = hit.object->getMaterial(hit.point);
+	return true;
+}
+
+void BVH::closestHitPacket(const RayPacket &packet, HitRecord *hits) const {
+	const int n = packet.count;
+	alignas(32) float tHit[RayPacket::size];
+	for (int i = 0; i < n; i++) {
+		hits[i].t = std::numeric_limits<float>::infinity();
+		hits[i].object = NULL;
+	}
+	for (int i = 0; i < n; i++) {
+		intersectUnbounded(packet.ray(i), hits[i]);
+		tHit[i] = hits[i].t;
+	}
+
+	if (!nodes.empty()) {
+		const glm::vec3 &o = packet.origin;
+		char active[RayPacket::size];
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node &node = nodes[stack[--top]];
+
+			// slab test of every ray against the box.  The rays share their
+			// origin, so the box planes relative to it are found once, and
+			// the loop over the rays has no branches and vectorizes.
+			//
+			glm::vec3 lo = node.bmin - o;
+			glm::vec3 hi = node.bmax - o;
+			int anyActive = 0;
+			for (int i = 0; i < n; i++) {
+				float tx0 = lo.x * packet.invX[i], tx1 = hi.x * packet.invX[i];
+				float ty0 = lo.y * packet.invY[i], ty1 = hi.y * packet.invY[i];
+				float tz0 = lo.z * packet.invZ[i], tz1 = hi.z * packet.invZ[i];
+				float enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+				float exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tHit[i]));
+				active[i] = enter <= exit;
+				anyActive |= active[i];
+			}
+			if (!anyActive) continue;
+
+			if (node.count > 0) {
+				for (int i = 0; i < n; i++) {
+					if (!active[i]) continue;
+					intersectLeaf(node, packet.ray(i), hits[i]);
+					tHit[i] = hits[i].t;
+				}
+			}
+			else {
+				// near child first, judged once for the whole packet from
+				// the shared origin
+				int nearChild = &node - &nodes[0] + 1;
+				int farChild = node.index;
+				float dNear = glm::distance2((nodes[nearChild].bmin + nodes[nearChild].bmax) * 0.5f, o);
+				float dFar = glm::distance2((nodes[farChild].bmin + nodes[farChild].bmax) * 0.5f, o);
+				if (dFar < dNear) std::swap(nearChild, farChild);
+				stack[top++] = farChild;
+				stack[top++] = nearChild;
+			}
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (hits[i].object) hits[i].material = hits[i].object->getMaterial(hits[i].point);
+	}
+}
+
+bool BVH::anyHit(const Ray &ray, float tMax) const {
+	HitRecord hit;
+	for (const PlaneShape &plane : unboundedPlanes) {
+		if (plane.intersect(ray, tMax, hit)) return true;
+	}
+	for (SceneObject *obj : unbounded) {
+		if (obj->intersect(ray, tMax, hit)) return true;
+	}
+	if (nodes.empty()) return false;
+
+	glm::vec3 invDir = slabInverse(ray.d);
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node &node = nodes[stack[--top]];
+		if (!hitBox(node, ray.p, invDir, tMax)) continue;
+		if (node.count > 0) {
+			if (node.spheres > 0 && sphereSet.any(ray, node.index, node.spheres, tMax)) return true;
+			int planesEnd = node.index + node.spheres + node.planes;
+			for (int i = node.index + node.spheres; i < planesEnd; i++) {
+				if (planeShapes[i].intersect(ray, tMax, hit)) return true;
+			}
+			for (int i = planesEnd; i < node.index + node.count; i++) {
+				if (prims[i]->intersect(ray, tMax, hit)) return true;
+			}
+		}
+		else {
+			stack[top++] = node.index;
+			stack[top++] = &node - &nodes[0] + 1;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "ofMain.h"
+#include "SphereSet.h"
+
+class Ray;
+class SceneObject;
+struct HitRecord;
+struct RayPacket;
+
+//  Bounding volume hierarchy over the scene objects.  Objects that report
+//  bounds through SceneObject::getBounds() go into a binary tree of axis
+//  aligned boxes; objects without finite bounds (planes sloped so steeply
+//  their box overflows) are kept in a short list that is tested on every
+//  query.
+//
+//  The trace loops don't go through SceneObject pointers for the shapes
+//  scenes are built from.  Spheres are copied into a SphereSet and planes
+//  into a flat PlaneShape array, both in leaf order: every leaf lists its
+//  spheres, then its planes, then anything else.  Spheres are tested
+//  together with the vector kernel and planes with an inline test, so only
+//  other kinds of objects still cost a virtual intersect() call.  The
+//  SceneObject is looked up once per ray, for the material of the nearest
+//  hit.
+//
+class BVH {
+public:
+	void build(const std::vector<SceneObject*> &objects);
+
+	// nearest hit along the ray closer than tMax, with the material of the
+	// object that was hit.  returns false on a miss.
+	//
+	bool closestHit(const Ray &ray, HitRecord &hit, float tMax = std::numeric_limits<float>::infinity()) const;
+
+	// closestHit() for every ray of a packet of primary rays.  The tree is
+	// walked once for the whole packet; a node is entered if any ray that
+	// is still looking hits its box.  hits[i].object is NULL on a miss.
+	//
+	void closestHitPacket(const RayPacket &packet, HitRecord *hits) const;
+
+	// true as soon as any object is hit closer than tMax - for shadow rays
+	//
+	bool anyHit(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const;
+
+private:
+	//  flattened tree node.  Leaves have count > 0 and index the first of
+	//  their objects in prims, the first spheres of which are spheres and
+	//  the next planes planes; interior nodes have count == 0, their left
+	//  child directly follows them and index is the right child.
+	//
+	struct Node {
+		glm::vec3 bmin, bmax;
+		int index;
+		int count;
+		int spheres;
+		int planes;
+	};
+
+	//  geometry of a Plane or MirrorPlane, the same test as
+	//  Plane::intersect() without the GL primitive the objects carry
+	//
+	struct PlaneShape {
+		glm::vec3 position, normal;
+		glm::vec3 u, v;                  // planeExtentAxes()
+		float halfWidth, halfHeight;
+		SceneObject *object;
+		bool intersect(const Ray &ray, float tMax, HitRecord &hit) const;
+	};
+	static bool toPlaneShape(SceneObject *obj, PlaneShape &shape);
+
+	struct BuildPrim {
+		SceneObject *obj;
+		glm::vec3 bmin, bmax, centroid;
+	};
+
+	int buildNode(std::vector<BuildPrim> &build, int first, int count);
+	static bool hitBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir, float tMax);
+	void intersectUnbounded(const Ray &ray, HitRecord &hit) const;
+	void intersectLeaf(const Node &node, const Ray &ray, HitRecord &hit) const;
+
+	std::vector<Node> nodes;
+	std::vector<SceneObject*> prims;
+	std::vector<SceneObject*> unbounded;             // neither spheres nor planes
+	std::vector<PlaneShape> unboundedPlanes;         // near vertical slopes
+	SphereSet sphereSet;                  // slot i is prims[i] if that is a sphere
+	std::vector<PlaneShape> planeShapes;  // and planeShapes[i] if it is a plane
+
+	// a leaf fills one vector of the sphere kernel
+	static const int leafSize = SphereSet::lanes < 4 ? 4 : SphereSet::lanes;
+};
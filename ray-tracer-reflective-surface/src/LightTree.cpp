@@ -0,0 +1,120 @@
+#include "LightTree.h"
+#include "ofApp.h"
+
+#include <algorithm>
+
+void LightTree::build(const std::vector<AreaLight*> &lights) {
+	nodes.clear();
+	std::vector<BuildLight> build;
+	for (size_t i = 0; i < lights.size(); i++) {
+		const AreaLight *light = lights[i];
+		BuildLight b;
+		b.light = i;
+		b.intensity = light->intensity;
+		b.bmin = b.bmax = light->position;
+		for (const glm::vec3 &v : light->verts) {
+			b.bmin = glm::min(b.bmin, v);
+			b.bmax = glm::max(b.bmax, v);
+		}
+		b.centroid = (b.bmin + b.bmax) * 0.5f;
+		if (b.intensity > 0) build.push_back(b);
+	}
+	if (build.empty()) return;
+	nodes.reserve(2 * build.size());
+	buildNode(build, 0, build.size());
+}
+
+// split at the median centroid of the widest axis down to single lights
+//
+int LightTree::buildNode(std::vector<BuildLight> &build, int first, int count) {
+	int nodeIndex = nodes.size();
+	nodes.push_back(Node());
+
+	glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+	glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+	float intensity = 0;
+	for (int i = first; i < first + count; i++) {
+		bmin = glm::min(bmin, build[i].bmin);
+		bmax = glm::max(bmax, build[i].bmax);
+		cmin = glm::min(cmin, build[i].centroid);
+		cmax = glm::max(cmax, build[i].centroid);
+		intensity += build[i].intensity;
+	}
+	nodes[nodeIndex].bmin = bmin;
+	nodes[nodeIndex].bmax = bmax;
+	nodes[nodeIndex].intensity = intensity;
+
+	if (count == 1) {
+		nodes[nodeIndex].light = build[first].light;
+		nodes[nodeIndex].index = 0;
+		return nodeIndex;
+	}
+
+	glm::vec3 extent = cmax - cmin;
+	int axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+	int half = count / 2;
+	std::nth_element(build.begin() + first, build.begin() + first + half, build.begin() + first + count,
+		[axis](const BuildLight &a, const BuildLight &b) { return a.centroid[axis] < b.centroid[axis]; });
+
+	buildNode(build, first, half);
+	int second = buildNode(build, first + half, count - half);
+	nodes[nodeIndex].light = -1;
+	nodes[nodeIndex].index = second;
+	return nodeIndex;
+}
+
+// Distance is measured to the box center but never taken as less than half
+// the box diagonal, so the points near or inside a cluster of lights
+// don't favor whichever child center happens to be nearest.  The
+// orientation term is the steepest corner of the box above the surface,
+// kept above a floor: the specular and mirror terms of phong() still see
+// lights below the horizon.
+//
+float LightTree::importance(const Node &node, const glm::vec3 &p, const glm::vec3 &n) {
+	glm::vec3 center = (node.bmin + node.bmax) * 0.5f;
+	float halfDiagonal2 = glm::length2(node.bmax - node.bmin) * 0.25f;
+	float d2 = std::max(glm::distance2(center, p), std::max(halfDiagonal2, 1e-4f));
+
+	float cosine = 1;
+	bool inside = glm::clamp(p, node.bmin, node.bmax) == p;
+	if (!inside) {
+		cosine = -1;
+		for (int c = 0; c < 8; c++) {
+			glm::vec3 corner((c & 1) ? node.bmax.x : node.bmin.x, (c & 2) ? node.bmax.y : node.bmin.y, (c & 4) ? node.bmax.z : node.bmin.z);
+			glm::vec3 dir = corner - p;
+			float len = glm::length(dir);
+			if (len > 0) cosine = std::max(cosine, glm::dot(dir, n) / len);
+		}
+	}
+	return node.intensity / d2 * std::max(cosine, 0.1f);
+}
+
+int LightTree::sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &pdf) const {
+	pdf = 1;
+	if (nodes.empty()) return -1;
+	int node = 0;
+	while (nodes[node].light < 0) {
+		int first = node + 1;
+		int second = nodes[node].index;
+		float w0 = importance(nodes[first], p, n);
+		float w1 = importance(nodes[second], p, n);
+		float p0 = w0 + w1 > 0 ? w0 / (w0 + w1) : 0.5f;
+
+		// reuse u for the next level by stretching the part of [0, 1) that
+		// picked the child back over the whole interval
+		if (u < p0) {
+			node = first;
+			pdf *= p0;
+			u = u / p0;
+		}
+		else {
+			node = second;
+			pdf *= 1 - p0;
+			u = (u - p0) / (1 - p0);
+		}
+		u = std::min(u, 0.99999994f);
+	}
+	return nodes[node].light;
+}
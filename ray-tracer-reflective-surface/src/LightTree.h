@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ofMain.h"
+
+class AreaLight;
+
+//  Binary tree over the area lights, for scenes with too many of them to
+//  sample every light at every shading point.  Each node stores the box
+//  around its emitters and their total intensity.  sample() walks down from
+//  the root picking one child at a time with probability proportional to an
+//  estimate of how much light it sends to the shading point:
+//
+//    intensity / distance^2 * how far the box rises above the surface
+//
+//  so a handful of samples per point lands on the few lights that matter
+//  and the cost doesn't grow with the number of lights.  The estimate is
+//  never zero, so every light keeps a chance to be picked and the result,
+//  weighted by 1 / pdf, is unbiased.
+//
+class LightTree {
+public:
+	void build(const std::vector<AreaLight*> &lights);
+
+	// pick a light for shading point p with normal n using u in [0, 1).
+	// returns its index in the lights build() was given and sets pdf to the
+	// probability it was picked with; -1 if there are no lights.
+	//
+	int sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &pdf) const;
+
+	bool empty() const { return nodes.empty(); }
+
+private:
+	//  flattened tree node, laid out like BVH::Node.  Leaves have light
+	//  >= 0; interior nodes have their first child directly after them
+	//  and index the second.
+	//
+	struct Node {
+		glm::vec3 bmin, bmax;
+		float intensity;
+		int light;
+		int index;
+	};
+
+	struct BuildLight {
+		int light;
+		glm::vec3 bmin, bmax, centroid;
+		float intensity;
+	};
+
+	int buildNode(std::vector<BuildLight> &build, int first, int count);
+	static float importance(const Node &node, const glm::vec3 &p, const glm::vec3 &n);
+
+	std::vector<Node> nodes;
+};
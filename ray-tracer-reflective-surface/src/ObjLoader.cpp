@@ -0,0 +1,305 @@
+#include "ObjLoader.h"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+//  Read-only memory mapping of a whole file
+//
+class MappedFile {
+public:
+	MappedFile(const std::string &path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping) return;
+		data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data) size = fileSize.QuadPart;
+#else
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) return;
+		data = (const char *)p;
+		size = st.st_size;
+#endif
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (data) munmap((void *)data, size);
+		if (fd >= 0) close(fd);
+#endif
+	}
+
+	const char *data = NULL;
+	size_t size = 0;
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
+
+//  Cursor over the mapped text.  All parsing is done in place - no line is
+//  ever copied out of the file.
+//
+struct Cursor {
+	const char *p, *end;
+
+	void skipSpaces() { while (p < end && (*p == ' ' || *p == '\t')) p++; }
+	void skipLine() {
+		while (p < end && *p != '\n') p++;
+		if (p < end) p++;
+	}
+	bool atLineEnd() { return p >= end || *p == '\n' || *p == '\r' || *p == '#'; }
+
+	bool readFloat(float &f) {
+		skipSpaces();
+		// from_chars does not accept a leading '+'
+		if (p < end && *p == '+') p++;
+		std::from_chars_result r = std::from_chars(p, end, f);
+		if (r.ec != std::errc()) return false;
+		p = r.ptr;
+		return true;
+	}
+	bool readInt(int &i) {
+		std::from_chars_result r = std::from_chars(p, end, i);
+		if (r.ec != std::errc()) return false;
+		p = r.ptr;
+		return true;
+	}
+};
+
+// OBJ indices are 1 based, negative ones count back from the last element.
+// returns false for 0 and anything outside the count elements read so far.
+//
+bool resolveIndex(int index, size_t count, int &resolved) {
+	if (index == 0 || (index > 0 && (size_t)index > count) || (index < 0 && (size_t)-(int64_t)index > count)) return false;
+	resolved = index < 0 ? (int)count + index : index - 1;
+	return true;
+}
+
+// returns the number of faces skipped for referring to a vertex or normal
+// that doesn't exist
+//
+int parseObj(const char *data, size_t size, ObjMesh &mesh) {
+	Cursor c = { data, data + size };
+	std::vector < int > faceVerts, faceNormals;
+	int skipped = 0;
+
+	while (c.p < c.end) {
+		c.skipSpaces();
+		if (c.end - c.p >= 2 && c.p[0] == 'v' && (c.p[1] == ' ' || c.p[1] == '\t')) {
+			c.p += 2;
+			glm::vec3 v;
+			if (c.readFloat(v.x) && c.readFloat(v.y) && c.readFloat(v.z)) mesh.verts.push_back(v);
+		}
+		else if (c.end - c.p >= 3 && c.p[0] == 'v' && c.p[1] == 'n' && (c.p[2] == ' ' || c.p[2] == '\t')) {
+			c.p += 3;
+			glm::vec3 n;
+			if (c.readFloat(n.x) && c.readFloat(n.y) && c.readFloat(n.z)) mesh.normals.push_back(n);
+		}
+		else if (c.end - c.p >= 2 && c.p[0] == 'f' && (c.p[1] == ' ' || c.p[1] == '\t')) {
+			c.p += 2;
+			faceVerts.clear();
+			faceNormals.clear();
+			bool valid = true;
+			for (c.skipSpaces(); !c.atLineEnd(); c.skipSpaces()) {
+				// corner is v, v/vt, v//vn or v/vt/vn
+				int v, vt, vn = 0;
+				if (!c.readInt(v)) break;
+				if (c.p < c.end && *c.p == '/') {
+					c.p++;
+					if (c.p < c.end && *c.p != '/') c.readInt(vt);
+					if (c.p < c.end && *c.p == '/') {
+						c.p++;
+						c.readInt(vn);
+					}
+				}
+				int vi, ni = -1;
+				valid = valid && resolveIndex(v, mesh.verts.size(), vi) && (vn == 0 || resolveIndex(vn, mesh.normals.size(), ni));
+				faceVerts.push_back(vi);
+				faceNormals.push_back(ni);
+			}
+			if (!valid) {
+				skipped++;
+				faceVerts.clear();
+			}
+			// fan triangulate quads and polygons
+			for (size_t i = 2; i < faceVerts.size(); i++) {
+				mesh.tris.push_back(faceVerts[0]);
+				mesh.tris.push_back(faceVerts[i - 1]);
+				mesh.tris.push_back(faceVerts[i]);
+				mesh.triNormals.push_back(faceNormals[0]);
+				mesh.triNormals.push_back(faceNormals[i - 1]);
+				mesh.triNormals.push_back(faceNormals[i]);
+			}
+		}
+		c.skipLine();
+	}
+	return skipped;
+}
+
+//  Binary cache layout: CacheHeader followed by the verts, normals, tris and
+//  triNormals arrays, each written as raw memory.  The source size and
+//  modification time are stored so an edited OBJ is parsed again.
+//
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t numVerts, numNormals, numTris;
+};
+
+const uint32_t cacheVersion = 1;
+
+// read count elements, of the left bytes still in the file.  A count the
+// file can't hold is a corrupt cache, not a reason to allocate it.
+//
+template <class T>
+bool readArray(FILE *f, std::vector < T > &v, uint64_t count, uint64_t &left) {
+	if (count > left / sizeof(T)) return false;
+	left -= count * sizeof(T);
+	v.resize(count);
+	return count == 0 || fread(v.data(), sizeof(T), count, f) == count;
+}
+
+// every triangle corner refers to a vertex, and to a normal or none (-1)
+//
+bool validIndices(const ObjMesh &mesh) {
+	for (int i : mesh.tris) {
+		if (i < 0 || (size_t)i >= mesh.verts.size()) return false;
+	}
+	for (int i : mesh.triNormals) {
+		if (i < -1 || (i >= 0 && (size_t)i >= mesh.normals.size())) return false;
+	}
+	return true;
+}
+
+template <class T>
+bool writeArray(FILE *f, const std::vector < T > &v) {
+	return v.empty() || fwrite(v.data(), sizeof(T), v.size(), f) == v.size();
+}
+
+bool sourceStamp(const std::string &path, uint64_t &size, int64_t &time) {
+	std::error_code ec;
+	size = std::filesystem::file_size(path, ec);
+	if (ec) return false;
+	time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	return !ec;
+}
+
+bool loadCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime, ObjMesh &mesh) {
+	std::error_code ec;
+	uint64_t fileSize = std::filesystem::file_size(cachePath, ec);
+	if (ec || fileSize < sizeof(CacheHeader)) return false;
+	FILE *f = fopen(cachePath.c_str(), "rb");
+	if (!f) return false;
+	CacheHeader h;
+	uint64_t left = fileSize - sizeof(h);
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+		memcmp(h.magic, "OBJC", 4) == 0 && h.version == cacheVersion &&
+		h.sourceSize == sourceSize && h.sourceTime == sourceTime &&
+		h.numTris <= left / (3 * sizeof(int)) &&
+		readArray(f, mesh.verts, h.numVerts, left) &&
+		readArray(f, mesh.normals, h.numNormals, left) &&
+		readArray(f, mesh.tris, 3 * h.numTris, left) &&
+		readArray(f, mesh.triNormals, 3 * h.numTris, left) &&
+		left == 0 && validIndices(mesh);
+	fclose(f);
+	return ok;
+}
+
+void saveCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime, const ObjMesh &mesh) {
+	FILE *f = fopen(cachePath.c_str(), "wb");
+	if (!f) return;     // read-only data directory, just parse next time
+	CacheHeader h;
+	memcpy(h.magic, "OBJC", 4);
+	h.version = cacheVersion;
+	h.sourceSize = sourceSize;
+	h.sourceTime = sourceTime;
+	h.numVerts = mesh.verts.size();
+	h.numNormals = mesh.normals.size();
+	h.numTris = mesh.tris.size() / 3;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+		writeArray(f, mesh.verts) && writeArray(f, mesh.normals) &&
+		writeArray(f, mesh.tris) && writeArray(f, mesh.triNormals);
+	fclose(f);
+	if (!ok) remove(cachePath.c_str());
+}
+
+//  Meshes already loaded by this process, so a long running app that
+//  reloads its scene doesn't go back to disk
+//
+struct ResidentMesh {
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	ObjMesh mesh;
+};
+
+std::mutex residentLock;
+std::map < std::string, ResidentMesh > residentMeshes;
+
+}
+
+bool loadObj(const std::string &path, ObjMesh &mesh, bool useCache) {
+	mesh = ObjMesh();
+	std::string cachePath = path + ".cache";
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!sourceStamp(path, sourceSize, sourceTime)) return false;
+
+	if (useCache) {
+		std::lock_guard<std::mutex> guard(residentLock);
+		auto found = residentMeshes.find(path);
+		if (found != residentMeshes.end() && found->second.sourceSize == sourceSize && found->second.sourceTime == sourceTime) {
+			mesh = found->second.mesh;
+			return true;
+		}
+	}
+
+	if (!useCache || !loadCache(cachePath, sourceSize, sourceTime, mesh)) {
+		mesh = ObjMesh();
+		MappedFile file(path);
+		if (!file.data) return false;
+		int skipped = parseObj(file.data, file.size, mesh);
+		if (skipped) std::cout << "loadObj: skipped " << skipped << " faces with bad indices in " << path << std::endl;
+		if (useCache) saveCache(cachePath, sourceSize, sourceTime, mesh);
+	}
+
+	if (useCache) {
+		std::lock_guard<std::mutex> guard(residentLock);
+		residentMeshes[path] = ResidentMesh{ sourceSize, sourceTime, mesh };
+	}
+	return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Geometry read from a Wavefront OBJ file.  Faces are fan triangulated;
+//  indices are 0 based.
+//
+struct ObjMesh {
+	std::vector < glm::vec3 > verts;
+	std::vector < glm::vec3 > normals;
+	std::vector < int > tris;          // 3 vertex indices per triangle
+	std::vector < int > triNormals;    // 3 normal indices per triangle, -1 if the corner has none
+};
+
+//  Load the v, vn and f lines of an OBJ file.  The file is memory mapped and
+//  parsed in place with std::from_chars.  Unless useCache is false, the result
+//  is also written to a binary sidecar (<path>.cache) which later loads of
+//  the same, unmodified file read straight into the arrays instead, and the
+//  mesh is kept in memory for later loads by the same process.  Faces that
+//  refer to a vertex or normal the file doesn't define are skipped with a
+//  warning, and a cache that doesn't match its file is parsed again.
+//
+//  returns false if the file could not be read.
+//
+bool loadObj(const std::string &path, ObjMesh &mesh, bool useCache = true);
@@ -0,0 +1,177 @@
+#include "Profiler.h"
+
+#if defined(RT_PROFILE)
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct ZoneInfo {
+	const char *name;
+	bool timeline;     // keep every call as an event, not just the totals
+};
+
+const ZoneInfo zones[Profiler::ZoneCount] = {
+	{ "render", true },
+	{ "tile", true },
+	{ "primary", false },
+	{ "reflect", false },
+	{ "phong", false },
+	{ "shadow", false },
+	{ "texture", false },
+	{ "save", true },
+};
+
+const char *counterNames[Profiler::CounterCount] = { "primary rays", "shadow rays", "reflect rays" };
+
+// timeline events kept per thread; past this only the totals grow
+const size_t maxEvents = 1 << 20;
+
+struct Event {
+	Profiler::Zone zone;
+	int64_t start, end;
+};
+
+// everything one thread recorded.  Logs outlive their threads - the
+// render workers are gone by the time the trace is written - and the log
+// of a thread that exited is handed to the next new thread.
+//
+struct ThreadLog {
+	int id;
+	bool live = true;
+	int64_t calls[Profiler::ZoneCount] = {};
+	int64_t ns[Profiler::ZoneCount] = {};
+	int64_t counters[Profiler::CounterCount] = {};
+	std::vector < Event > events;
+};
+
+std::mutex registryLock;
+std::vector < std::unique_ptr < ThreadLog > > logs;
+const int64_t epoch = Profiler::now();
+
+ThreadLog *claimLog() {
+	std::lock_guard<std::mutex> guard(registryLock);
+	for (auto &log : logs) {
+		if (!log->live) {
+			log->live = true;
+			return log.get();
+		}
+	}
+	logs.emplace_back(new ThreadLog());
+	logs.back()->id = logs.size() - 1;
+	return logs.back().get();
+}
+
+struct ThreadSlot {
+	ThreadLog *log = claimLog();
+	~ThreadSlot() {
+		std::lock_guard<std::mutex> guard(registryLock);
+		log->live = false;
+	}
+};
+
+inline ThreadLog &threadLog() {
+	thread_local ThreadSlot slot;
+	return *slot.log;
+}
+
+}
+
+bool Profiler::enabled() { return true; }
+
+void Profiler::add(Zone zone, int64_t startNs, int64_t endNs) {
+	ThreadLog &log = threadLog();
+	log.calls[zone]++;
+	log.ns[zone] += endNs - startNs;
+	if (zones[zone].timeline && log.events.size() < maxEvents) log.events.push_back(Event{ zone, startNs, endNs });
+}
+
+void Profiler::count(Counter counter, int64_t n) {
+	threadLog().counters[counter] += n;
+}
+
+void Profiler::reset() {
+	std::lock_guard<std::mutex> guard(registryLock);
+	for (auto &log : logs) {
+		std::fill(log->calls, log->calls + ZoneCount, 0);
+		std::fill(log->ns, log->ns + ZoneCount, 0);
+		std::fill(log->counters, log->counters + CounterCount, 0);
+		log->events.clear();
+	}
+}
+
+// complete ("X") events in microseconds, one track per thread log, and the
+// counters as one counter ("C") event at the end of the trace
+//
+bool Profiler::writeChromeTrace(const std::string &path) {
+	std::lock_guard<std::mutex> guard(registryLock);
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f) return false;
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	const char *separator = "";
+	int64_t last = 0;
+	for (auto &log : logs) {
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+			separator, log->id, log->id);
+		separator = ",\n";
+		for (const Event &e : log->events) {
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				zones[e.zone].name, log->id, (e.start - epoch) / 1000.0, (e.end - e.start) / 1000.0);
+			last = std::max(last, e.end);
+		}
+	}
+	for (int c = 0; c < CounterCount; c++) {
+		int64_t total = 0;
+		for (auto &log : logs) total += log->counters[c];
+		fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{\"count\":%lld}}",
+			separator, counterNames[c], (last - epoch) / 1000.0, (long long)total);
+		separator = ",\n";
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	return fclose(f) == 0;
+}
+
+// totals over all threads.  Thread seconds add up across threads, so with
+// n workers the per zone times can be up to n times the wall clock time.
+//
+void Profiler::printSummary(std::ostream &out) {
+	std::lock_guard<std::mutex> guard(registryLock);
+	out << std::left << std::setw(10) << "zone" << std::right << std::setw(14) << "calls"
+		<< std::setw(14) << "thread s" << std::setw(12) << "ns / call" << std::endl;
+	for (int z = 0; z < ZoneCount; z++) {
+		int64_t calls = 0, ns = 0;
+		for (auto &log : logs) {
+			calls += log->calls[z];
+			ns += log->ns[z];
+		}
+		if (calls == 0) continue;
+		out << std::left << std::setw(10) << zones[z].name << std::right << std::setw(14) << calls
+			<< std::setw(14) << std::fixed << std::setprecision(3) << ns / 1e9
+			<< std::setw(12) << std::setprecision(0) << double(ns) / calls << std::endl;
+	}
+	for (int c = 0; c < CounterCount; c++) {
+		int64_t total = 0;
+		for (auto &log : logs) total += log->counters[c];
+		out << std::left << std::setw(14) << counterNames[c] << std::right << std::setw(10) << total << std::endl;
+	}
+	out << std::defaultfloat;
+}
+
+#else
+
+// built without RT_PROFILE: nothing is recorded and nothing is written
+
+bool Profiler::enabled() { return false; }
+void Profiler::add(Zone, int64_t, int64_t) {}
+void Profiler::count(Counter, int64_t) {}
+void Profiler::reset() {}
+bool Profiler::writeChromeTrace(const std::string &) { return false; }
+void Profiler::printSummary(std::ostream &) {}
+
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+//  Timeline of where a render spends its time, for builds compiled with
+//  RT_PROFILE defined (-DRT_PROFILE, or in the project's preprocessor
+//  definitions).  Without it PROFILE_SCOPE and PROFILE_COUNT expand to
+//  nothing and the render code is exactly what it was.
+//
+//    PROFILE_SCOPE(Profiler::Phong);            // time the enclosing block
+//    PROFILE_COUNT(Profiler::ShadowRays, 1);    // bump a counter
+//
+//  Each thread records into its own log, so the hot paths take no locks.
+//  Every scope adds to per zone call counts and times; zones that run a
+//  few times per frame (render, tile, save) are also kept as individual
+//  events for the timeline.  Times are inclusive: phong() contains the
+//  shadow rays it shoots.
+//
+//  After a render, writeChromeTrace() writes the events as Chrome trace
+//  JSON (load it in chrome://tracing or ui.perfetto.dev) and
+//  printSummary() a table of the totals.  Both should only be called while
+//  no render is running.
+//
+class Profiler {
+public:
+	enum Zone {
+		Render,       // one rayTrace() / streamed / distributed frame
+		Tile,         // one tile or band
+		Primary,      // closest hit of primary rays
+		Reflect,      // closest hit of mirror bounces
+		Phong,        // direct lighting of one hit, shadow rays included
+		Shadow,       // one shadow ray
+		Texture,      // one texture lookup
+		Save,         // encoding and writing an image
+		ZoneCount
+	};
+
+	enum Counter {
+		PrimaryRays,
+		ShadowRays,
+		ReflectRays,
+		CounterCount
+	};
+
+	static bool enabled();
+
+	static void add(Zone zone, int64_t startNs, int64_t endNs);
+	static void count(Counter counter, int64_t n);
+	static int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// drop everything recorded so far
+	//
+	static void reset();
+
+	static bool writeChromeTrace(const std::string &path);
+	static void printSummary(std::ostream &out);
+
+	struct Scope {
+		Scope(Zone zone) : zone(zone), start(now()) {}
+		~Scope() { add(zone, start, now()); }
+		Zone zone;
+		int64_t start;
+	};
+};
+
+#if defined(RT_PROFILE)
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(zone) Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(zone)
+#define PROFILE_COUNT(counter, n) Profiler::count(counter, n)
+#else
+#define PROFILE_SCOPE(zone)
+#define PROFILE_COUNT(counter, n)
+#endif
@@ -0,0 +1,172 @@
+#include "RenderJournal.h"
+
+#include <cstring>
+
+RenderJournal::Header RenderJournal::makeHeader(const char *magic) const {
+	Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, magic, 4);
+	h.version = version;
+	h.width = width;
+	h.height = height;
+	h.tileSize = tileSize;
+	h.settingsKey = settingsKey;
+	return h;
+}
+
+bool RenderJournal::headerMatches(const Header &h, const char *magic) const {
+	Header expected = makeHeader(magic);
+	return memcmp(&h, &expected, sizeof(h)) == 0;
+}
+
+// tiles are in render coordinates (y up), the image is stored top row first
+//
+Tile RenderJournal::tileRect(int index) const {
+	int x0 = (index % tilesX) * tileSize;
+	int y0 = (index / tilesX) * tileSize;
+	Tile tile = { x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height) };
+	return tile;
+}
+
+int RenderJournal::resume(const std::string &base, int width, int height, int tileSize, uint64_t settingsKey,
+	ofPixels &pixels, std::vector < char > &done) {
+	close();
+	this->base = base;
+	this->width = width;
+	this->height = height;
+	this->tileSize = tileSize;
+	this->settingsKey = settingsKey;
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+	done.assign(tilesX * tilesY, 0);
+	tileBuffer.resize(size_t(tileSize) * tileSize * 3);
+
+	if (!loadCheckpoint(pixels, done)) done.assign(tilesX * tilesY, 0);
+	replayJournal(pixels, done);
+	finished = done;
+	// nothing is rendering yet, so the whole frame is a safe snapshot
+	frame.assign(pixels.getData(), pixels.getData() + size_t(width) * height * 3);
+
+	// fold whatever was replayed into a fresh checkpoint, then start an
+	// empty journal on top of it
+	//
+	int restored = 0;
+	for (char d : done) restored += d;
+	if (restored > 0) checkpoint();
+	else startJournal();
+	lastCheckpoint = ofGetElapsedTimeMillis();
+	return restored;
+}
+
+bool RenderJournal::loadCheckpoint(ofPixels &pixels, std::vector < char > &done) {
+	FILE *f = fopen((base + ".ckpt").c_str(), "rb");
+	if (!f) return false;
+	Header h;
+	size_t bytes = size_t(width) * height * 3;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 && headerMatches(h, "RTCK") &&
+		fread(done.data(), 1, done.size(), f) == done.size() &&
+		fread(pixels.getData(), 1, bytes, f) == bytes;
+	fclose(f);
+	return ok;
+}
+
+// records are [int32 tile index][tile pixels, bottom row first].  A record
+// cut short by a crash is dropped.
+//
+int RenderJournal::replayJournal(ofPixels &pixels, std::vector < char > &done) {
+	FILE *f = fopen((base + ".journal").c_str(), "rb");
+	if (!f) return 0;
+	Header h;
+	int replayed = 0;
+	if (fread(&h, sizeof(h), 1, f) == 1 && headerMatches(h, "RTJN")) {
+		int32_t index;
+		while (fread(&index, sizeof(index), 1, f) == 1) {
+			if (index < 0 || index >= (int)done.size()) break;
+			Tile tile = tileRect(index);
+			size_t rowBytes = size_t(tile.x1 - tile.x0) * 3;
+			size_t bytes = rowBytes * (tile.y1 - tile.y0);
+			if (fread(tileBuffer.data(), 1, bytes, f) != bytes) break;
+			for (int j = tile.y0; j < tile.y1; j++) {
+				unsigned char *row = pixels.getData() + (size_t(height - j - 1) * width + tile.x0) * 3;
+				memcpy(row, &tileBuffer[(j - tile.y0) * rowBytes], rowBytes);
+			}
+			done[index] = 1;
+			replayed++;
+		}
+	}
+	fclose(f);
+	return replayed;
+}
+
+bool RenderJournal::startJournal() {
+	if (journal) fclose(journal);
+	journal = fopen((base + ".journal").c_str(), "wb");
+	if (!journal) return false;
+	Header h = makeHeader("RTJN");
+	fwrite(&h, sizeof(h), 1, journal);
+	fflush(journal);
+	return true;
+}
+
+void RenderJournal::tileDone(int tileIndex, const Tile &tile, const ofPixels &pixels) {
+	std::lock_guard<std::mutex> guard(lock);
+	finished[tileIndex] = 1;
+
+	size_t rowBytes = size_t(tile.x1 - tile.x0) * 3;
+	for (int j = tile.y0; j < tile.y1; j++) {
+		size_t offset = (size_t(height - j - 1) * width + tile.x0) * 3;
+		memcpy(&frame[offset], pixels.getData() + offset, rowBytes);
+		memcpy(&tileBuffer[(j - tile.y0) * rowBytes], pixels.getData() + offset, rowBytes);
+	}
+	if (!journal) return;
+
+	int32_t index = tileIndex;
+	fwrite(&index, sizeof(index), 1, journal);
+	fwrite(tileBuffer.data(), 1, rowBytes * (tile.y1 - tile.y0), journal);
+	fflush(journal);
+}
+
+void RenderJournal::maybeCheckpoint(float interval) {
+	if (ofGetElapsedTimeMillis() - lastCheckpoint < interval * 1000) return;
+	std::lock_guard<std::mutex> guard(lock);
+	// another worker may have just written one
+	if (ofGetElapsedTimeMillis() - lastCheckpoint < interval * 1000) return;
+	checkpoint();
+	lastCheckpoint = ofGetElapsedTimeMillis();
+}
+
+// Called with the lock held (or before workers start), so no journal record
+// is in flight.  Writes frame, not the live pixels: workers keep tracing
+// other tiles into those while this runs.
+//
+void RenderJournal::checkpoint() {
+	std::string tmp = base + ".ckpt.tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f) return;
+	Header h = makeHeader("RTCK");
+	size_t bytes = size_t(width) * height * 3;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+		fwrite(finished.data(), 1, finished.size(), f) == finished.size() &&
+		fwrite(frame.data(), 1, bytes, f) == bytes;
+	ok = (fclose(f) == 0) && ok;
+
+	std::error_code ec;
+	if (ok) filesystem::rename(tmp, base + ".ckpt", ec);
+	if (!ok || ec) {
+		filesystem::remove(tmp, ec);
+		return;     // keep appending to the old journal
+	}
+	startJournal();
+}
+
+void RenderJournal::finish() {
+	close();
+	std::error_code ec;
+	filesystem::remove(base + ".journal", ec);
+	filesystem::remove(base + ".ckpt", ec);
+}
+
+void RenderJournal::close() {
+	if (journal) fclose(journal);
+	journal = NULL;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TilePool.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+//  Crash safe progress record for long tile renders.
+//
+//  <base>.journal is an append-only log: every finished tile is written to
+//  it with its pixels as soon as it is done.  Every so often checkpoint()
+//  writes the whole partial frame plus the set of finished tiles to
+//  <base>.ckpt (via a temp file and rename, so it is never half written) and
+//  starts the journal over.  resume() loads the checkpoint and replays the
+//  journal on top of it, so an interrupted render loses at most the tiles
+//  that were still being traced.
+//
+class RenderJournal {
+public:
+	~RenderJournal() { close(); }
+
+	// start journaling a width x height render cut into tileSize tiles.
+	// settingsKey identifies everything else that affects the pixels; a
+	// checkpoint or journal from a different render is ignored.  Finished
+	// tiles found on disk are copied into pixels and flagged in done.
+	//
+	// returns the number of tiles restored.
+	//
+	int resume(const std::string &base, int width, int height, int tileSize, uint64_t settingsKey,
+		ofPixels &pixels, std::vector < char > &done);
+
+	// record a finished tile; its pixels must already be in pixels
+	//
+	void tileDone(int tileIndex, const Tile &tile, const ofPixels &pixels);
+
+	// write a checkpoint now if interval seconds have passed since the last
+	// one.  Only the tiles already passed to tileDone go into it.
+	//
+	void maybeCheckpoint(float interval);
+
+	// render complete - delete the journal and checkpoint
+	//
+	void finish();
+
+	void close();
+
+	int tileIndex(const Tile &tile) const { return (tile.y0 / tileSize) * tilesX + tile.x0 / tileSize; }
+
+private:
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		int32_t width, height, tileSize;
+		uint64_t settingsKey;
+	};
+
+	Header makeHeader(const char *magic) const;
+	bool headerMatches(const Header &h, const char *magic) const;
+	Tile tileRect(int index) const;
+	bool loadCheckpoint(ofPixels &pixels, std::vector < char > &done);
+	int replayJournal(ofPixels &pixels, std::vector < char > &done);
+	bool startJournal();
+	void checkpoint();
+
+	std::string base;
+	int width = 0, height = 0, tileSize = 0, tilesX = 0, tilesY = 0;
+	uint64_t settingsKey = 0;
+	std::vector < char > finished;
+	FILE *journal = NULL;
+	std::mutex lock;
+	std::atomic<uint64_t> lastCheckpoint{ 0 };
+	std::vector < unsigned char > tileBuffer;
+	std::vector < unsigned char > frame;     // finished tiles only, what a checkpoint writes
+
+	static const uint32_t version = 1;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ofMain.h"
+#include <cstdint>
+
+//  Counter based random numbers.  Every value is a pure hash of
+//  (pixel, dimension, sample index), so there is no generator state to share
+//  or lock between threads, and a pixel gets the same numbers no matter which
+//  worker renders it or in what order.
+//
+inline uint64_t hashCounter(uint64_t x) {
+	// splitmix64 finalizer
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+// uniform float in [0, 1) from the top 24 bits of a hash
+//
+inline float hashToFloat(uint64_t h) {
+	return (h >> 40) * (1.0f / 16777216.0f);
+}
+
+//  Per-pixel sample generator.  A renderer calls startPixel() once per pixel
+//  and nextDimension() before each independent set of samples (one per light
+//  per bounce).  Within a set, get1D() and get2D() are the golden ratio and R2
+//  low discrepancy sequences with a per-pixel random shift, so any first n
+//  samples cover the domain evenly instead of clumping like rand() % n, and
+//  neighbouring pixels get decorrelated patterns.
+//
+class Sampler {
+public:
+	// pass seeds repeated renders of the same pixel (progressive, supersampled)
+	//
+	void startPixel(uint64_t pixelIndex, int pass = 0) {
+		pixel = pixelIndex ^ (uint64_t(pass) << 40);
+		dimension = 0;
+		updateShifts();
+	}
+
+	void nextDimension() {
+		dimension++;
+		updateShifts();
+	}
+
+	// uniform random number for sample i of the current dimension
+	//
+	float random(int i, int stream = 0) const {
+		uint64_t key = hashCounter(pixel * 0x100000001b3ull ^ hashCounter((uint64_t(dimension) << 32) | uint32_t(stream)));
+		return hashToFloat(hashCounter(key + uint64_t(i)));
+	}
+
+	// sample i of the shifted golden ratio sequence in [0, 1)
+	//
+	float get1D(int i) const {
+		const float a = 0.6180339887498949f;     // 1 / golden ratio
+		float x = shift1 + a * i;
+		return x - floor(x);
+	}
+
+	// sample i of the shifted R2 sequence in [0, 1)^2
+	//
+	glm::vec2 get2D(int i) const {
+		const float a1 = 0.7548776662466927f;    // 1 / plastic number
+		const float a2 = 0.5698402909980532f;    // 1 / plastic number^2
+		float x = shift2.x + a1 * i;
+		float y = shift2.y + a2 * i;
+		return glm::vec2(x - floor(x), y - floor(y));
+	}
+
+private:
+	// the random shifts only change with the pixel and dimension, so hash
+	// them once here instead of for every sample
+	//
+	void updateShifts() {
+		shift1 = random(0, 1);
+		shift2 = glm::vec2(random(0, 2), random(0, 3));
+	}
+
+	uint64_t pixel = 0;
+	int dimension = 0;
+	float shift1 = 0;
+	glm::vec2 shift2;
+};
@@ -0,0 +1,90 @@
+#include "ScanlineWriter.h"
+
+#include <cstring>
+
+namespace {
+
+void put16(unsigned char *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+void put32(unsigned char *p, uint32_t v) { put16(p, v & 0xffff); put16(p + 2, v >> 16); }
+
+}
+
+bool ScanlineWriter::open(const filesystem::path &path, int width, int height) {
+	close();
+	std::string ext = path.extension().string();
+	if (ext != ".ppm" && ext != ".bmp") return false;
+	bmp = ext == ".bmp";
+	this->width = width;
+	this->height = height;
+
+	file = fopen(path.string().c_str(), "wb");
+	if (!file) return false;
+	ok = true;
+
+	if (bmp) {
+		// BMP rows are BGR, padded to 4 bytes, stored bottom row first
+		rowStride = (int64_t(width) * 3 + 3) / 4 * 4;
+		dataOffset = 54;
+		int64_t imageSize = rowStride * height;
+
+		unsigned char header[54] = {};
+		header[0] = 'B';
+		header[1] = 'M';
+		put32(header + 2, uint32_t(dataOffset + imageSize));
+		put32(header + 10, uint32_t(dataOffset));
+		put32(header + 14, 40);                   // BITMAPINFOHEADER
+		put32(header + 18, width);
+		put32(header + 22, height);               // positive = bottom up
+		put16(header + 26, 1);                    // planes
+		put16(header + 28, 24);                   // bits per pixel
+		put32(header + 34, uint32_t(imageSize));
+		put32(header + 38, 2835);                 // 72 dpi
+		put32(header + 42, 2835);
+		ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+		rowBuffer.assign(rowStride, 0);
+	}
+	else {
+		rowStride = int64_t(width) * 3;
+		char header[64];
+		int n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+		dataOffset = n;
+		ok = fwrite(header, 1, n, file) == size_t(n);
+	}
+	return ok;
+}
+
+bool ScanlineWriter::writeRow(int y, const unsigned char *rgb) {
+	if (!file || y < 0 || y >= height) return false;
+	if (bmp) {
+		unsigned char *out = rowBuffer.data();
+		for (int x = 0; x < width; x++) {
+			out[3 * x] = rgb[3 * x + 2];
+			out[3 * x + 1] = rgb[3 * x + 1];
+			out[3 * x + 2] = rgb[3 * x];
+		}
+		ok = ok && seek(dataOffset + int64_t(height - 1 - y) * rowStride) &&
+			fwrite(out, 1, rowStride, file) == size_t(rowStride);
+	}
+	else {
+		ok = ok && seek(dataOffset + int64_t(y) * rowStride) &&
+			fwrite(rgb, 1, rowStride, file) == size_t(rowStride);
+	}
+	return ok;
+}
+
+bool ScanlineWriter::close() {
+	if (!file) return ok;
+	ok = (fclose(file) == 0) && ok;
+	file = NULL;
+	return ok;
+}
+
+// 64 bit seek, rows of very large frames lie past 2GB
+//
+bool ScanlineWriter::seek(int64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+}
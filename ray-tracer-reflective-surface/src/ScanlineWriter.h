@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ofMain.h"
+#include <cstdint>
+#include <cstdio>
+
+//  Writes an uncompressed RGB image a few rows at a time, so a frame never
+//  has to be held in memory as a whole.  Every row sits at a fixed offset in
+//  the file, so rows can arrive in any order.  Supports binary PPM (.ppm) and
+//  24 bit BMP (.bmp).
+//
+class ScanlineWriter {
+public:
+	~ScanlineWriter() { close(); }
+
+	// create the file and write its header.  returns false if the extension
+	// is not .ppm/.bmp or the file can't be created.
+	//
+	bool open(const filesystem::path &path, int width, int height);
+
+	// write one row of width packed RGB bytes.  y = 0 is the top of the image.
+	//
+	bool writeRow(int y, const unsigned char *rgb);
+
+	bool close();
+
+private:
+	bool seek(int64_t offset);
+
+	FILE *file = NULL;
+	bool bmp = false;
+	bool ok = true;
+	int width = 0, height = 0;
+	int64_t dataOffset = 0;
+	int64_t rowStride = 0;
+	std::vector < unsigned char > rowBuffer;
+};
@@ -0,0 +1,310 @@
+#include "SceneFile.h"
+#include "Sampler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+int32_t SceneDesc::addString(const std::string &s) {
+	int32_t offset = strings.size();
+	strings.insert(strings.end(), s.begin(), s.end());
+	strings.push_back(0);
+	return offset;
+}
+
+uint64_t SceneDesc::hash() const {
+	uint64_t h = 0;
+	auto add = [&h](const void *data, size_t bytes) {
+		const unsigned char *p = (const unsigned char *)data;
+		for (size_t i = 0; i < bytes; i += 8) {
+			uint64_t word = 0;
+			memcpy(&word, p + i, std::min<size_t>(8, bytes - i));
+			h = hashCounter(h ^ word);
+		}
+	};
+	add(&camera, sizeof(camera));
+	add(&ambient, sizeof(ambient));
+	add(&background, sizeof(background));
+	add(materials.data(), materials.size() * sizeof(SceneMaterial));
+	add(shapes.data(), shapes.size() * sizeof(SceneShape));
+	add(lights.data(), lights.size() * sizeof(SceneLight));
+	add(strings.data(), strings.size());
+	return h;
+}
+
+namespace {
+
+//  Text parsing
+//
+bool readVec3(std::istringstream &in, glm::vec3 &v) {
+	return bool(in >> v.x >> v.y >> v.z);
+}
+
+bool readColor(std::istringstream &in, ofColor &c) {
+	int r, g, b;
+	if (!(in >> r >> g >> b)) return false;
+	c = ofColor(ofClamp(r, 0, 255), ofClamp(g, 0, 255), ofClamp(b, 0, 255));
+	return true;
+}
+
+int32_t findMaterial(const SceneDesc &scene, const std::string &name) {
+	for (size_t i = 0; i < scene.materials.size(); i++) {
+		if (name == scene.string(scene.materials[i].name)) return i;
+	}
+	return -1;
+}
+
+// parse one statement.  returns an error message, empty if the line is fine
+//
+std::string parseLine(std::istringstream &in, SceneDesc &scene) {
+	std::string keyword;
+	if (!(in >> keyword)) return "";     // blank line
+
+	if (keyword == "camera") {
+		if (!readVec3(in, scene.camera.position)) return "camera needs <x y z>";
+	}
+	else if (keyword == "view") {
+		SceneCamera &c = scene.camera;
+		if (!(in >> c.viewMin.x >> c.viewMin.y >> c.viewMax.x >> c.viewMax.y >> c.viewZ)) return "view needs <minx miny maxx maxy> <z>";
+	}
+	else if (keyword == "ambient") {
+		if (!readColor(in, scene.ambient)) return "ambient needs <r g b>";
+	}
+	else if (keyword == "background") {
+		if (!readColor(in, scene.background)) return "background needs <r g b>";
+	}
+	else if (keyword == "material") {
+		std::string name;
+		SceneMaterial m;
+		m.texture = -1;
+		m.specular = ofColor::lightGray;
+		m.reflectiveness = 0;
+		if (!(in >> name) || !readColor(in, m.diffuse)) return "material needs <name> <r g b>";
+		if (findMaterial(scene, name) >= 0) return "material " + name + " is already defined";
+		std::string option;
+		while (in >> option) {
+			std::string texture;
+			if (option == "specular") {
+				if (!readColor(in, m.specular)) return "specular needs <r g b>";
+			}
+			else if (option == "reflect") {
+				if (!(in >> m.reflectiveness)) return "reflect needs <k>";
+			}
+			else if (option == "texture") {
+				if (!(in >> texture)) return "texture needs an image path";
+				m.texture = scene.addString(texture);
+			}
+			else return "unknown material option " + option;
+		}
+		m.name = scene.addString(name);
+		scene.materials.push_back(m);
+	}
+	else if (keyword == "sphere" || keyword == "plane") {
+		SceneShape s;
+		s.type = keyword == "sphere" ? SceneShape::Sphere : SceneShape::Plane;
+		s.normal = glm::vec3(0, 1, 0);
+		s.radius = 1;
+		s.width = s.height = 20;
+		std::string material;
+		if (s.type == SceneShape::Sphere) {
+			if (!readVec3(in, s.position) || !(in >> s.radius >> material)) return "sphere needs <x y z> <radius> <material>";
+		}
+		else {
+			if (!readVec3(in, s.position) || !readVec3(in, s.normal) || !(in >> material)) return "plane needs <x y z> <nx ny nz> <material>";
+			if (in >> s.width && !(in >> s.height)) return "plane size needs <width> <height>";
+			s.normal = glm::normalize(s.normal);
+		}
+		s.material = findMaterial(scene, material);
+		if (s.material < 0) return "unknown material " + material;
+		scene.shapes.push_back(s);
+	}
+	else if (keyword == "arealight") {
+		SceneLight l;
+		std::string shape;
+		if (!readVec3(in, l.position) || !(in >> l.intensity >> shape)) return "arealight needs <x y z> <intensity> <obj>";
+		l.shape = scene.addString(shape);
+		scene.lights.push_back(l);
+	}
+	else return "unknown statement " + keyword;
+
+	std::string extra;
+	if (in >> extra) return "unexpected " + extra + " after " + keyword;
+	return "";
+}
+
+bool parseScene(const std::string &path, SceneDesc &scene, std::string &error) {
+	std::ifstream file(path);
+	if (!file) {
+		error = "can't read " + path;
+		return false;
+	}
+	std::string line;
+	for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) line.erase(comment);
+		std::istringstream in(line);
+		std::string message = parseLine(in, scene);
+		if (!message.empty()) {
+			error = path + ":" + ofToString(lineNumber) + ": " + message;
+			return false;
+		}
+	}
+	return true;
+}
+
+//  Binary layout: BinaryHeader, then the camera, ambient and background,
+//  then the materials, shapes, lights and string table as raw arrays.  The
+//  source size and modification time are only set in the cache written next
+//  to a text scene, so an edited scene is parsed again.
+//
+struct BinaryHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t numMaterials, numShapes, numLights, stringBytes;
+};
+
+const uint32_t binaryVersion = 1;
+
+// read count elements, of the left bytes still in the file.  A count the
+// file can't hold is a damaged file, not a reason to allocate it.
+//
+template <class T>
+bool readArray(FILE *f, std::vector < T > &v, uint64_t count, uint64_t &left) {
+	if (count > left / sizeof(T)) return false;
+	left -= count * sizeof(T);
+	v.resize(count);
+	return count == 0 || fread(v.data(), sizeof(T), count, f) == count;
+}
+
+template <class T>
+bool writeArray(FILE *f, const std::vector < T > &v) {
+	return v.empty() || fwrite(v.data(), sizeof(T), v.size(), f) == v.size();
+}
+
+// check every index in a compiled scene, so a damaged file can't send the
+// renderer out of bounds
+//
+bool validate(const SceneDesc &scene) {
+	int32_t stringBytes = scene.strings.size();
+	auto validString = [&](int32_t offset) { return offset >= 0 && offset < stringBytes; };
+	if (stringBytes > 0 && scene.strings.back() != 0) return false;
+	for (const SceneMaterial &m : scene.materials) {
+		if (!validString(m.name) || (m.texture != -1 && !validString(m.texture))) return false;
+	}
+	for (const SceneShape &s : scene.shapes) {
+		if (s.material < 0 || s.material >= (int32_t)scene.materials.size()) return false;
+		if (s.type != SceneShape::Sphere && s.type != SceneShape::Plane) return false;
+	}
+	for (const SceneLight &l : scene.lights) {
+		if (!validString(l.shape)) return false;
+	}
+	return true;
+}
+
+bool readBinary(const std::string &path, uint64_t sourceSize, int64_t sourceTime, bool checkSource, SceneDesc &scene) {
+	const uint64_t fixedBytes = sizeof(BinaryHeader) + sizeof(scene.camera) + sizeof(scene.ambient) + sizeof(scene.background);
+	std::error_code ec;
+	uint64_t fileSize = std::filesystem::file_size(path, ec);
+	if (ec || fileSize < fixedBytes) return false;
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	BinaryHeader h;
+	uint64_t left = fileSize - fixedBytes;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+		memcmp(h.magic, "RTSC", 4) == 0 && h.version == binaryVersion &&
+		(!checkSource || (h.sourceSize == sourceSize && h.sourceTime == sourceTime)) &&
+		fread(&scene.camera, sizeof(scene.camera), 1, f) == 1 &&
+		fread(&scene.ambient, sizeof(scene.ambient), 1, f) == 1 &&
+		fread(&scene.background, sizeof(scene.background), 1, f) == 1 &&
+		readArray(f, scene.materials, h.numMaterials, left) &&
+		readArray(f, scene.shapes, h.numShapes, left) &&
+		readArray(f, scene.lights, h.numLights, left) &&
+		readArray(f, scene.strings, h.stringBytes, left) &&
+		left == 0 && validate(scene);
+	fclose(f);
+	return ok;
+}
+
+bool writeBinary(const std::string &path, uint64_t sourceSize, int64_t sourceTime, const SceneDesc &scene) {
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	BinaryHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "RTSC", 4);
+	h.version = binaryVersion;
+	h.sourceSize = sourceSize;
+	h.sourceTime = sourceTime;
+	h.numMaterials = scene.materials.size();
+	h.numShapes = scene.shapes.size();
+	h.numLights = scene.lights.size();
+	h.stringBytes = scene.strings.size();
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+		fwrite(&scene.camera, sizeof(scene.camera), 1, f) == 1 &&
+		fwrite(&scene.ambient, sizeof(scene.ambient), 1, f) == 1 &&
+		fwrite(&scene.background, sizeof(scene.background), 1, f) == 1 &&
+		writeArray(f, scene.materials) && writeArray(f, scene.shapes) &&
+		writeArray(f, scene.lights) && writeArray(f, scene.strings);
+	ok = (fclose(f) == 0) && ok;
+	if (!ok) remove(path.c_str());
+	return ok;
+}
+
+bool sourceStamp(const std::string &path, uint64_t &size, int64_t &time) {
+	std::error_code ec;
+	size = std::filesystem::file_size(path, ec);
+	if (ec) return false;
+	time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	return !ec;
+}
+
+// make the texture and mesh paths absolute, relative ones are taken from
+// the scene file's folder
+//
+void resolvePaths(SceneDesc &scene, const std::string &scenePath) {
+	std::filesystem::path folder = std::filesystem::absolute(scenePath).parent_path();
+	auto resolve = [&](int32_t &offset) {
+		std::filesystem::path p = scene.string(offset);
+		if (p.is_relative()) offset = scene.addString((folder / p).string());
+	};
+	for (SceneMaterial &m : scene.materials) {
+		if (m.texture >= 0) resolve(m.texture);
+	}
+	for (SceneLight &l : scene.lights) resolve(l.shape);
+}
+
+}
+
+bool loadScene(const std::string &path, SceneDesc &scene, std::string &error, bool useCache) {
+	scene = SceneDesc();
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!sourceStamp(path, sourceSize, sourceTime)) {
+		error = "can't read " + path;
+		return false;
+	}
+
+	if (std::filesystem::path(path).extension() == ".scenebin") {
+		if (!readBinary(path, 0, 0, false, scene)) {
+			error = path + " is not a compiled scene or is damaged";
+			return false;
+		}
+	}
+	else {
+		std::string cachePath = path + ".bin";
+		if (!useCache || !readBinary(cachePath, sourceSize, sourceTime, true, scene)) {
+			scene = SceneDesc();
+			if (!parseScene(path, scene, error)) return false;
+			// read-only scene folder, just parse next time
+			if (useCache) writeBinary(cachePath, sourceSize, sourceTime, scene);
+		}
+	}
+	resolvePaths(scene, path);
+	return true;
+}
+
+bool saveSceneBinary(const std::string &path, const SceneDesc &scene) {
+	return writeBinary(path, 0, 0, scene);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ofMain.h"
+#include <cstdint>
+
+//  Scene description read from a text .scene file.  Everything is plain old
+//  data - strings live in one table and are referenced by offset - so the
+//  compiled binary form is just these arrays written out raw and loads with
+//  a handful of freads.
+//
+//  Text format, one statement per line, # starts a comment:
+//
+//    camera     <x y z>                          eye position
+//    view       <minx miny maxx maxy> <z>        view plane, facing -z
+//    ambient    <r g b>
+//    background <r g b>
+//    material   <name> <r g b> [specular <r g b>] [reflect <k>] [texture <image>]
+//    sphere     <x y z> <radius> <material>
+//    plane      <x y z> <nx ny nz> <material> [<width> <height>]
+//    arealight  <x y z> <intensity> <obj>
+//
+//  Colors are 0-255.  Image and obj paths are relative to the scene file.
+//  A plane is 20 x 20 unless sized: width in x and height in z for a floor,
+//  ceiling or slope, width along the wall and height up for a wall.
+//  A material has to be declared before it is used.
+//
+struct SceneCamera {
+	glm::vec3 position = glm::vec3(0, 0, 10);
+	glm::vec2 viewMin = glm::vec2(-3, -2);
+	glm::vec2 viewMax = glm::vec2(3, 2);
+	float viewZ = 5;
+};
+
+struct SceneMaterial {
+	int32_t name;              // string offsets, texture is -1 for none
+	int32_t texture;
+	ofColor diffuse;
+	ofColor specular;
+	float reflectiveness;
+};
+
+struct SceneShape {
+	enum Type : int32_t { Sphere, Plane };
+	Type type;
+	int32_t material;          // index into materials
+	glm::vec3 position;
+	glm::vec3 normal;          // planes only
+	float radius;              // spheres only
+	float width, height;       // planes only
+};
+
+struct SceneLight {
+	int32_t shape;             // string offset of the light's obj mesh
+	glm::vec3 position;
+	float intensity;
+};
+
+struct SceneDesc {
+	SceneCamera camera;
+	ofColor ambient = ofColor(40, 40, 40);
+	ofColor background = ofColor::black;
+	std::vector < SceneMaterial > materials;
+	std::vector < SceneShape > shapes;
+	std::vector < SceneLight > lights;
+	std::vector < char > strings;     // NUL terminated, referenced by offset
+
+	const char *string(int32_t offset) const { return offset < 0 ? "" : &strings[offset]; }
+	int32_t addString(const std::string &s);
+
+	// hash of the whole description, to tell renders of different scenes apart
+	uint64_t hash() const;
+};
+
+//  Load a scene.  A compiled scene (.scenebin) is read directly.  For a text
+//  scene a compiled copy is kept next to it (<path>.bin) unless useCache is
+//  false, and is used instead of parsing as long as the text file is
+//  unchanged.  Relative paths inside the scene are resolved against the
+//  scene file's folder.
+//
+//  returns false and sets error if the file can't be read or has a mistake.
+//
+bool loadScene(const std::string &path, SceneDesc &scene, std::string &error, bool useCache = true);
+
+//  Write a compiled scene.  Generators of large scenes can write this
+//  directly and skip the text form entirely.
+//
+bool saveSceneBinary(const std::string &path, const SceneDesc &scene);
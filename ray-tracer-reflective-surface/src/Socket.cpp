@@ -0,0 +1,202 @@
+#include "Socket.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#if !defined(MSG_NOSIGNAL) && !defined(SO_NOSIGPIPE)
+#include <csignal>
+#endif
+#endif
+
+// A peer that went away must not kill us with SIGPIPE.  Linux asks for that
+// per send() with MSG_NOSIGNAL, macOS and the BSDs per socket with
+// SO_NOSIGPIPE; anything else ignores the signal for the whole process in
+// startup().  Windows has no SIGPIPE.
+//
+#ifdef MSG_NOSIGNAL
+static const int sendFlags = MSG_NOSIGNAL;
+#else
+static const int sendFlags = 0;
+#endif
+
+// options of every connected socket
+//
+static void configure(Socket::Handle handle) {
+	int yes = 1;
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char *)&yes, sizeof(yes));
+#ifdef SO_NOSIGPIPE
+	setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&yes, sizeof(yes));
+#endif
+}
+
+Socket::Handle Socket::invalid() {
+#ifdef _WIN32
+	return INVALID_SOCKET;
+#else
+	return -1;
+#endif
+}
+
+bool Socket::startup() {
+#ifdef _WIN32
+	static bool started = [] {
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	return started;
+#else
+#if !defined(MSG_NOSIGNAL) && !defined(SO_NOSIGPIPE)
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	return true;
+#endif
+}
+
+Socket &Socket::operator=(Socket &&other) {
+	if (this != &other) {
+		close();
+		handle = other.handle;
+		other.handle = invalid();
+	}
+	return *this;
+}
+
+bool Socket::listen(int port, bool localOnly) {
+	close();
+	if (!startup()) return false;
+	handle = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (!isOpen()) return false;
+
+	// a restarted coordinator can bind the port again right away
+	int yes = 1;
+	setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(localOnly ? INADDR_LOOPBACK : INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (::bind(handle, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(handle, 16) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool Socket::accept(Socket &client, float timeout) {
+	if (!isOpen()) return false;
+	fd_set ready;
+	FD_ZERO(&ready);
+	FD_SET(handle, &ready);
+	timeval tv;
+	tv.tv_sec = long(timeout);
+	tv.tv_usec = long((timeout - tv.tv_sec) * 1e6);
+	if (select(int(handle + 1), &ready, NULL, NULL, &tv) <= 0) return false;
+
+	client.close();
+	client.handle = ::accept(handle, NULL, NULL);
+	if (!client.isOpen()) return false;
+	configure(client.handle);
+	return true;
+}
+
+bool Socket::connect(const std::string &host, int port) {
+	close();
+	if (!startup()) return false;
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *found = NULL;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) return false;
+
+	for (addrinfo *a = found; a; a = a->ai_next) {
+		handle = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (!isOpen()) continue;
+		if (::connect(handle, a->ai_addr, (int)a->ai_addrlen) == 0) break;
+		close();
+	}
+	freeaddrinfo(found);
+	if (!isOpen()) return false;
+	configure(handle);
+	return true;
+}
+
+bool Socket::sendAll(const void *data, size_t bytes) {
+	const char *p = (const char *)data;
+	while (bytes > 0) {
+#ifdef _WIN32
+		int n = ::send(handle, p, (int)std::min<size_t>(bytes, 1 << 30), 0);
+#else
+		ssize_t n = ::send(handle, p, bytes, sendFlags);
+#endif
+		if (n <= 0) return false;
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+bool Socket::recvAll(void *data, size_t bytes) {
+	char *p = (char *)data;
+	while (bytes > 0) {
+#ifdef _WIN32
+		int n = ::recv(handle, p, (int)std::min<size_t>(bytes, 1 << 30), 0);
+#else
+		ssize_t n = ::recv(handle, p, bytes, 0);
+#endif
+		if (n <= 0) return false;     // closed, failed or timed out
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+// one byte at a time - only used for short command lines
+//
+bool Socket::recvLine(std::string &line, size_t maxBytes) {
+	line.clear();
+	char c;
+	while (recvAll(&c, 1)) {
+		if (c == '\n') {
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			return true;
+		}
+		if (line.size() >= maxBytes) return false;
+		line += c;
+	}
+	return false;
+}
+
+void Socket::setTimeout(float seconds) {
+#ifdef _WIN32
+	DWORD ms = DWORD(seconds * 1000);
+	setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (const char *)&ms, sizeof(ms));
+#else
+	timeval tv;
+	tv.tv_sec = long(seconds);
+	tv.tv_usec = long((seconds - tv.tv_sec) * 1e6);
+	setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+void Socket::close() {
+	if (!isOpen()) return;
+#ifdef _WIN32
+	closesocket(handle);
+#else
+	::close(handle);
+#endif
+	handle = invalid();
+}
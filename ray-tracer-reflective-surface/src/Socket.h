@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#endif
+
+//  Blocking TCP socket, just enough for the render coordinator and its
+//  workers.  Winsock on Windows, BSD sockets everywhere else.
+//
+class Socket {
+public:
+#ifdef _WIN32
+	typedef SOCKET Handle;
+#else
+	typedef int Handle;
+#endif
+
+	Socket() {}
+	~Socket() { close(); }
+	Socket(Socket &&other) { handle = other.handle; other.handle = invalid(); }
+	Socket &operator=(Socket &&other);
+	Socket(const Socket &) = delete;
+	Socket &operator=(const Socket &) = delete;
+
+	// listen for connections on port, on all interfaces or, with localOnly,
+	// only from this machine
+	//
+	bool listen(int port, bool localOnly = false);
+
+	// wait up to timeout seconds for a connection.  returns false if none
+	// arrived.
+	//
+	bool accept(Socket &client, float timeout);
+
+	bool connect(const std::string &host, int port);
+
+	// send / receive exactly bytes bytes.  false if the connection closed,
+	// failed or a receive timed out.
+	//
+	bool sendAll(const void *data, size_t bytes);
+	bool recvAll(void *data, size_t bytes);
+
+	// receive one line of text, without its '\n' (or "\r\n").  false if the
+	// connection ends first or the line is longer than maxBytes.
+	//
+	bool recvLine(std::string &line, size_t maxBytes = 4096);
+
+	// how long recvAll() waits for data before failing, 0 = forever
+	//
+	void setTimeout(float seconds);
+
+	bool isOpen() const { return handle != invalid(); }
+	void close();
+
+private:
+	static Handle invalid();
+	static bool startup();
+
+	Handle handle = invalid();
+};
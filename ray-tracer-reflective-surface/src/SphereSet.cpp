@@ -0,0 +1,181 @@
+#include "SphereSet.h"
+#include "ofApp.h"
+
+#include <cfloat>
+
+void SphereSet::resize(int n) {
+	// empty slots have a negative squared radius, which no ray can hit
+	cx.assign(n + lanes - 1, 0);
+	cy.assign(n + lanes - 1, 0);
+	cz.assign(n + lanes - 1, 0);
+	r2.assign(n + lanes - 1, -1);
+	r.assign(n + lanes - 1, 0);
+}
+
+void SphereSet::set(int slot, const glm::vec3 &center, float radius) {
+	cx[slot] = center.x;
+	cy[slot] = center.y;
+	cz[slot] = center.z;
+	r[slot] = radius;
+	r2[slot] = radius * radius;
+}
+
+#if defined(SPHERESET_AVX) || defined(SPHERESET_SSE)
+
+namespace {
+
+// the few vector operations the kernel needs, so the same code compiles to
+// AVX or SSE2
+//
+#if defined(SPHERESET_AVX)
+
+typedef __m256 Floats;
+inline Floats load(const float *p) { return _mm256_loadu_ps(p); }
+inline Floats splat(float f) { return _mm256_set1_ps(f); }
+inline Floats lessThan(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Floats lessEqual(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline Floats select(Floats mask, Floats a, Floats b) { return _mm256_blendv_ps(b, a, mask); }
+inline int bits(Floats mask) { return _mm256_movemask_ps(mask); }
+inline Floats laneIndex() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+#define F_ADD _mm256_add_ps
+#define F_SUB _mm256_sub_ps
+#define F_MUL _mm256_mul_ps
+#define F_SQRT _mm256_sqrt_ps
+#define F_AND _mm256_and_ps
+#define F_MAX _mm256_max_ps
+
+#elif defined(SPHERESET_SSE)
+
+typedef __m128 Floats;
+inline Floats load(const float *p) { return _mm_loadu_ps(p); }
+inline Floats splat(float f) { return _mm_set1_ps(f); }
+inline Floats lessThan(Floats a, Floats b) { return _mm_cmplt_ps(a, b); }
+inline Floats lessEqual(Floats a, Floats b) { return _mm_cmple_ps(a, b); }
+inline Floats select(Floats mask, Floats a, Floats b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline int bits(Floats mask) { return _mm_movemask_ps(mask); }
+inline Floats laneIndex() { return _mm_setr_ps(0, 1, 2, 3); }
+#define F_ADD _mm_add_ps
+#define F_SUB _mm_sub_ps
+#define F_MUL _mm_mul_ps
+#define F_SQRT _mm_sqrt_ps
+#define F_AND _mm_and_ps
+#define F_MAX _mm_max_ps
+
+#endif
+
+// ray broadcast across the lanes
+//
+struct RayLanes {
+	RayLanes(const Ray &ray) :
+		ox(splat(ray.p.x)), oy(splat(ray.p.y)), oz(splat(ray.p.z)),
+		dx(splat(ray.d.x)), dy(splat(ray.d.y)), dz(splat(ray.d.z)) {}
+	Floats ox, oy, oz, dx, dy, dz;
+};
+
+// t of lanes spheres starting at slot, and the mask of the lanes that hit
+// in (epsilon, tMax).  Lanes at or past valid are masked off.
+//
+// Per lane these are the steps of glm::intersectRaySphere(): t0 is the
+// distance along the ray to the point nearest the center, t1 half the
+// chord.
+//
+inline Floats intersectLanes(const RayLanes &ray, const float *cx, const float *cy, const float *cz, const float *r2,
+	Floats tMax, int valid, Floats &t) {
+	Floats diffX = F_SUB(load(cx), ray.ox);
+	Floats diffY = F_SUB(load(cy), ray.oy);
+	Floats diffZ = F_SUB(load(cz), ray.oz);
+	Floats t0 = F_ADD(F_ADD(F_MUL(diffX, ray.dx), F_MUL(diffY, ray.dy)), F_MUL(diffZ, ray.dz));
+	Floats diffSq = F_ADD(F_ADD(F_MUL(diffX, diffX), F_MUL(diffY, diffY)), F_MUL(diffZ, diffZ));
+	Floats dSq = F_SUB(diffSq, F_MUL(t0, t0));
+	Floats radiusSq = load(r2);
+	Floats chord = lessEqual(dSq, radiusSq);
+
+	// clamp so lanes that miss don't take the root of a negative number
+	Floats t1 = F_SQRT(F_MAX(F_SUB(radiusSq, dSq), splat(0)));
+	Floats eps = splat(FLT_EPSILON);
+	Floats exitOnly = lessEqual(t0, F_ADD(t1, eps));     // origin inside: take the far hit
+	t = select(exitOnly, F_ADD(t0, t1), F_SUB(t0, t1));
+
+	Floats hit = F_AND(chord, F_AND(lessThan(eps, t), lessThan(t, tMax)));
+	return F_AND(hit, lessThan(laneIndex(), splat(float(valid))));
+}
+
+}
+
+int SphereSet::closest(const Ray &ray, int first, int count, float tMax, float &t) const {
+	RayLanes lanesRay(ray);
+	Floats bestT = splat(tMax);
+	Floats bestSlot = splat(-1);
+	for (int base = first; base < first + count; base += lanes) {
+		Floats laneT;
+		Floats hit = intersectLanes(lanesRay, &cx[base], &cy[base], &cz[base], &r2[base], bestT, first + count - base, laneT);
+		if (!bits(hit)) continue;
+		bestT = select(hit, laneT, bestT);
+		bestSlot = select(hit, F_ADD(laneIndex(), splat(float(base))), bestSlot);
+	}
+
+	// nearest of the per lane winners
+	alignas(32) float ts[lanes], slots[lanes];
+	memcpy(ts, &bestT, sizeof(ts));
+	memcpy(slots, &bestSlot, sizeof(slots));
+	int slot = -1;
+	for (int i = 0; i < lanes; i++) {
+		if (slots[i] >= 0 && ts[i] < tMax) {
+			tMax = ts[i];
+			slot = int(slots[i]);
+		}
+	}
+	if (slot >= 0) t = tMax;
+	return slot;
+}
+
+bool SphereSet::any(const Ray &ray, int first, int count, float tMax) const {
+	RayLanes lanesRay(ray);
+	Floats maxT = splat(tMax);
+	for (int base = first; base < first + count; base += lanes) {
+		Floats laneT;
+		if (bits(intersectLanes(lanesRay, &cx[base], &cy[base], &cz[base], &r2[base], maxT, first + count - base, laneT))) return true;
+	}
+	return false;
+}
+
+#else
+
+// no vector unit - one sphere at a time, same test
+//
+namespace {
+
+inline bool intersectOne(const Ray &ray, const glm::vec3 &center, float radiusSq, float tMax, float &t) {
+	glm::vec3 diff = center - ray.p;
+	float t0 = glm::dot(diff, ray.d);
+	float dSq = glm::dot(diff, diff) - t0 * t0;
+	if (dSq > radiusSq) return false;
+	float t1 = sqrt(radiusSq - dSq);
+	t = t0 > t1 + FLT_EPSILON ? t0 - t1 : t0 + t1;
+	return t > FLT_EPSILON && t < tMax;
+}
+
+}
+
+int SphereSet::closest(const Ray &ray, int first, int count, float tMax, float &t) const {
+	int slot = -1;
+	for (int i = first; i < first + count; i++) {
+		float ti;
+		if (intersectOne(ray, center(i), r2[i], tMax, ti)) {
+			tMax = ti;
+			slot = i;
+		}
+	}
+	if (slot >= 0) t = tMax;
+	return slot;
+}
+
+bool SphereSet::any(const Ray &ray, int first, int count, float tMax) const {
+	for (int i = first; i < first + count; i++) {
+		float t;
+		if (intersectOne(ray, center(i), r2[i], tMax, t)) return true;
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ofMain.h"
+
+class Ray;
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SPHERESET_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPHERESET_SSE 1
+#endif
+
+//  Spheres stored as separate center x / y / z and radius arrays, so one
+//  ray can be tested against a whole vector register of spheres at once:
+//  8 per instruction with AVX, 4 with SSE2, one at a time elsewhere.
+//  Slots are addressed by index; a slot without a sphere never hits.
+//
+//  The tests match glm::intersectRaySphere() - including the exit point for
+//  rays that start inside a sphere - but only compute t.  The caller works
+//  out the point and normal for the one sphere that wins.
+//
+class SphereSet {
+public:
+#if defined(SPHERESET_AVX)
+	static const int lanes = 8;
+#elif defined(SPHERESET_SSE)
+	static const int lanes = 4;
+#else
+	static const int lanes = 1;
+#endif
+
+	// n empty slots
+	//
+	void resize(int n);
+	void set(int slot, const glm::vec3 &center, float radius);
+
+	// nearest sphere in slots [first, first + count) hit closer than tMax.
+	// returns its slot and sets t, or -1 on a miss.
+	//
+	int closest(const Ray &ray, int first, int count, float tMax, float &t) const;
+
+	// true if any sphere in slots [first, first + count) is hit closer
+	// than tMax
+	//
+	bool any(const Ray &ray, int first, int count, float tMax) const;
+
+	glm::vec3 center(int slot) const { return glm::vec3(cx[slot], cy[slot], cz[slot]); }
+	float radius(int slot) const { return r[slot]; }
+
+private:
+	// lanes - 1 slots of padding past the end so a full vector load from
+	// the last slot stays inside the arrays
+	std::vector < float > cx, cy, cz, r2, r;
+};
@@ -0,0 +1,122 @@
+#include "TileCoordinator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+Tile TileCoordinator::tileRect(int index) const {
+	int x0 = (index % tilesX) * tileSize;
+	int y0 = (index / tilesX) * tileSize;
+	Tile tile = { x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height) };
+	return tile;
+}
+
+bool TileCoordinator::run(int port, int width, int height, int tileSize, uint64_t settingsKey,
+	const std::vector < char > &done, const TileHandler &tileFinished) {
+	this->width = width;
+	this->height = height;
+	this->tileSize = tileSize;
+	this->settingsKey = settingsKey;
+	this->tileFinished = &tileFinished;
+	tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+
+	pending.clear();
+	for (int i = 0; i < tilesX * tilesY; i++) {
+		if (i >= (int)done.size() || !done[i]) pending.push_back(i);
+	}
+	remaining = pending.size();
+	workers = 0;
+	if (remaining == 0) return true;
+
+	Socket listener;
+	if (!listener.listen(port)) {
+		std::cout << "TileCoordinator: can't listen on port " << port << std::endl;
+		return false;
+	}
+	std::cout << "TileCoordinator: " << remaining << " tiles, waiting for workers on port " << port << std::endl;
+
+	// keep taking workers until every tile is back, so a farm that lost all
+	// its workers can be restarted against the same coordinator
+	//
+	std::vector < std::thread > connections;
+	int nextId = 0;
+	while (true) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (remaining == 0) break;
+		}
+		Socket client;
+		if (listener.accept(client, .25)) {
+			connections.emplace_back(&TileCoordinator::serve, this, std::move(client), nextId++);
+		}
+	}
+	listener.close();
+	for (std::thread &t : connections) t.join();
+	return true;
+}
+
+void TileCoordinator::serve(Socket connection, int id) {
+	WorkerHello hello;
+	connection.setTimeout(10);
+	if (!connection.recvAll(&hello, sizeof(hello)) || memcmp(hello.magic, "RTWK", 4) != 0 || hello.version != version) {
+		std::cout << "TileCoordinator: worker " << id << " is not a render worker" << std::endl;
+		return;
+	}
+	if (hello.width != width || hello.height != height || hello.settingsKey != settingsKey) {
+		std::cout << "TileCoordinator: worker " << id << " renders a different frame or settings, dropped" << std::endl;
+		TileJob stop = { -1, { 0, 0, 0, 0 } };
+		connection.sendAll(&stop, sizeof(stop));
+		return;
+	}
+	connection.setTimeout(workerTimeout);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		workers++;
+		std::cout << "TileCoordinator: worker " << id << " joined, " << workers << " connected" << std::endl;
+	}
+
+	std::vector < unsigned char > rgb(size_t(tileSize) * tileSize * 3);
+	while (true) {
+		TileJob job;
+		{
+			// idle workers wait here: a tile may still come back from a
+			// worker that dies
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [this] { return remaining == 0 || !pending.empty(); });
+			if (remaining == 0) break;
+			job.index = pending.front();
+			pending.pop_front();
+		}
+		job.tile = tileRect(job.index);
+		size_t bytes = size_t(job.tile.x1 - job.tile.x0) * (job.tile.y1 - job.tile.y0) * 3;
+
+		int32_t index = heartbeat;
+		bool ok = connection.sendAll(&job, sizeof(job));
+		while (ok && index == heartbeat) ok = connection.recvAll(&index, sizeof(index));
+		ok = ok && index == job.index && connection.recvAll(rgb.data(), bytes);
+		if (!ok) {
+			std::lock_guard<std::mutex> guard(lock);
+			pending.push_front(job.index);
+			workers--;
+			std::cout << "TileCoordinator: lost worker " << id << ", tile " << job.index << " reassigned, "
+				<< workers << " connected" << std::endl;
+			changed.notify_all();
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(resultLock);
+			(*tileFinished)(job.index, job.tile, rgb.data());
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		remaining--;
+		if (remaining % 50 == 0) std::cout << "tiles left: " << remaining << std::endl;
+		if (remaining == 0) changed.notify_all();
+	}
+
+	TileJob stop = { -1, { 0, 0, 0, 0 } };
+	connection.sendAll(&stop, sizeof(stop));
+	std::lock_guard<std::mutex> guard(lock);
+	workers--;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "TilePool.h"
+#include "Socket.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//  Distributed rendering over TCP.  The coordinator cuts the frame into
+//  tiles and hands them one at a time to worker processes (ofApp::
+//  renderWorker) that connect to it; each worker sends back the pixels of
+//  its tile and gets the next one.  While it traces, a worker sends a
+//  heartbeat every heartbeatSeconds, so however long a tile takes, a worker
+//  is only given up on once it disconnects or says nothing for
+//  workerTimeout.  Its tile then goes back on the queue for another worker,
+//  so workers can die or be added at any time during the render.
+//
+//  Protocol, all fields in host byte order (the farm is one architecture):
+//
+//    worker -> coordinator   WorkerHello
+//    coordinator -> worker   TileJob                 index -1 = no more work
+//    worker -> coordinator   int32 heartbeat         any number, while tracing
+//    worker -> coordinator   int32 index, tile pixels (RGB, bottom row first)
+//    ... until the coordinator sends index -1
+//
+struct WorkerHello {
+	char magic[4];          // "RTWK"
+	uint32_t version;
+	int32_t width, height;
+	uint64_t settingsKey;   // ofApp::renderSettingsKey(), the worker has to render the same frame
+};
+
+struct TileJob {
+	int32_t index;
+	Tile tile;
+};
+
+class TileCoordinator {
+public:
+	// called once per tile as results arrive, with the tile's pixels bottom
+	// row first.  Calls are serialized.
+	//
+	typedef std::function<void(int index, const Tile &tile, const unsigned char *rgb)> TileHandler;
+
+	// serve every tile not flagged in done to workers connecting on port and
+	// block until all of them are back.  returns false if the port can't be
+	// opened.
+	//
+	bool run(int port, int width, int height, int tileSize, uint64_t settingsKey,
+		const std::vector < char > &done, const TileHandler &tileFinished);
+
+	float workerTimeout = 60;     // seconds a worker may go without a word
+
+	static const uint32_t version = 2;
+	static constexpr int32_t heartbeat = -2;    // sent in place of a tile index while still tracing
+	static constexpr int heartbeatSeconds = 5;
+
+private:
+	void serve(Socket connection, int id);
+	Tile tileRect(int index) const;
+
+	int width = 0, height = 0, tileSize = 0, tilesX = 0;
+	uint64_t settingsKey = 0;
+	const TileHandler *tileFinished = NULL;
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque < int > pending;   // tiles not handed out
+	int remaining = 0;            // tiles not back yet
+	int workers = 0;              // connected workers
+	std::mutex resultLock;        // serializes tileFinished
+};
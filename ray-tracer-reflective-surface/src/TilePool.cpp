@@ -0,0 +1,66 @@
+#include "TilePool.h"
+
+#include <algorithm>
+#include <thread>
+
+TilePool::TilePool(int numThreads) {
+	if (numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+	this->numThreads = std::max(numThreads, 1);
+}
+
+void TilePool::run(int width, int height, int tileSize, const std::function<void(const Tile &, int)> &renderTile) {
+	// std::mutex is not movable, so the queues are rebuilt for every frame
+	//
+	queues = std::vector<WorkerQueue>(numThreads);
+
+	// deal tiles round-robin so each worker starts with a spread of the frame
+	// rather than one contiguous (and possibly all expensive) band
+	//
+	int next = 0;
+	for (int y = 0; y < height; y += tileSize) {
+		for (int x = 0; x < width; x += tileSize) {
+			Tile tile = { x, y, std::min(x + tileSize, width), std::min(y + tileSize, height) };
+			queues[next].tiles.push_back(tile);
+			next = (next + 1) % numThreads;
+		}
+	}
+
+	auto worker = [&](int w) {
+		Tile tile;
+		while (popLocal(w, tile) || steal(w, tile)) {
+			renderTile(tile, w);
+		}
+	};
+
+	// the calling thread acts as worker 0
+	//
+	std::vector<std::thread> threads;
+	for (int w = 1; w < numThreads; w++) threads.emplace_back(worker, w);
+	worker(0);
+	for (std::thread &t : threads) t.join();
+}
+
+bool TilePool::popLocal(int worker, Tile &tile) {
+	WorkerQueue &q = queues[worker];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (q.tiles.empty()) return false;
+	tile = q.tiles.front();
+	q.tiles.pop_front();
+	return true;
+}
+
+// no tiles are added once a frame starts, so a worker that finds every
+// other queue empty in one pass is done
+//
+bool TilePool::steal(int worker, Tile &tile) {
+	for (int i = 1; i < numThreads; i++) {
+		WorkerQueue &q = queues[(worker + i) % numThreads];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if (!q.tiles.empty()) {
+			tile = q.tiles.back();
+			q.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
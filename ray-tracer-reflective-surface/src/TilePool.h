@@ -0,0 +1,43 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+//  Rectangle of pixels [x0, x1) x [y0, y1) in render (u, v) order - y grows up
+//
+struct Tile {
+	int x0, y0, x1, y1;
+};
+
+//  Work-stealing tile scheduler.  The frame is cut into square tiles which are
+//  dealt round-robin to one queue per worker.  A worker takes tiles from the
+//  front of its own queue and, once that runs dry, steals from the back of the
+//  other queues, so cores that finish cheap tiles (background, flat walls) pick
+//  up the work of cores stuck on expensive ones (mirror, penumbrae).
+//
+class TilePool {
+public:
+	TilePool(int numThreads = 0);     // 0 = one worker per hardware thread
+
+	// render every tile of a width x height frame with renderTile(tile, worker).
+	// worker is in [0, size()) and can be used to index per-thread state.
+	// Blocks until the whole frame is done.
+	//
+	void run(int width, int height, int tileSize, const std::function<void(const Tile &, int)> &renderTile);
+
+	int size() const { return numThreads; }
+
+private:
+	struct WorkerQueue {
+		std::mutex lock;
+		std::deque<Tile> tiles;
+	};
+
+	bool popLocal(int worker, Tile &tile);
+	bool steal(int worker, Tile &tile);
+
+	int numThreads;
+	std::vector<WorkerQueue> queues;
+};
@@ -1,8 +1,123 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "ofAppNoWindow.h"
+
+// Command line options for a headless render.  With no arguments the app
+// opens its window as usual.
+//
+static void usage(const char *exe) {
+	cout << "usage: " << exe << " [options]" << endl
+		<< "  renders one frame without a window or GL context, saves it and exits" << endl
+		<< endl
+		<< "  --scene <file>      .scene or compiled .scenebin file, relative to the data folder," << endl
+		<< "                      or mirror-room for the built-in scene (mirror-room)" << endl
+		<< "  --light <obj>       mesh of the ceiling area light of the built-in scene" << endl
+		<< "  --width <px>        image width (3000)" << endl
+		<< "  --height <px>       image height (2000)" << endl
+		<< "  --samples <n>       shadow rays per light for soft shadows (100)" << endl
+		<< "  --threads <n>       render threads, 0 = one per hardware thread (0)" << endl
+		<< "  --aa <n>            anti-aliasing budget, samples per pixel on edges and noise, 1 = off (16)" << endl
+		<< "  --aa-threshold <e>  brightness error (0..1) adaptive sampling stops at (.01)" << endl
+		<< "  --reservoirs        share light samples between neighboring pixels, two shadow" << endl
+		<< "                      rays per sample instead of up to --samples per light" << endl
+		<< "  --output <path>     image to write, relative to the data folder (images/image.png)" << endl
+		<< "  --stream            write the image band by band, output must be .ppm or .bmp" << endl
+		<< "  --no-checkpoint     don't journal tiles for resuming an interrupted render" << endl
+		<< "  --profile <json>    print where the time went and write a Chrome trace" << endl
+		<< "                      (chrome://tracing, ui.perfetto.dev); needs a build with RT_PROFILE" << endl
+		<< "  --bench <json>      time the kernels and a fixed size render of the scene, write" << endl
+		<< "                      ns / call and Mrays/s to json (relative to the data folder)" << endl
+		<< endl
+		<< "  distributed rendering - start one coordinator and any number of workers with" << endl
+		<< "  the same scene, size and samples:" << endl
+		<< "  --serve <port>      hand out tiles to workers and assemble the image, trace nothing" << endl
+		<< "  --worker <host:port>  trace tiles for the coordinator at host:port, write nothing" << endl
+		<< "  --worker-timeout <s>  seconds the coordinator waits on a silent worker before" << endl
+		<< "                      giving its tile to another (60); busy workers check in every 5" << endl
+		<< endl
+		<< "  --daemon <port>     stay running with the scene loaded and take render jobs on" << endl
+		<< "                      127.0.0.1:port, one per line, e.g." << endl
+		<< "                        render camera 0 1 12 samples 50 output images/a.png" << endl
+		<< "                        quit" << endl;
+}
+
+// Parse argv into the app's render settings.  returns false on a bad or
+// unknown option.
+//
+static bool parseArgs(int argc, char *argv[], ofApp *app) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		std::string value = hasValue ? argv[i + 1] : "";
+
+		if (arg == "--help" || arg == "-h") return false;
+		else if (arg == "--stream") app->streamOutput = true;
+		else if (arg == "--no-checkpoint") app->checkpointing = false;
+		else if (arg == "--reservoirs") app->reservoirSampling = true;
+		else if (!hasValue) {
+			cout << "unknown option or missing value: " << arg << endl;
+			return false;
+		}
+		else {
+			i++;
+			if (arg == "--scene") {
+				if (value != "mirror-room") app->sceneFile = value;
+			}
+			else if (arg == "--light") app->ceilingLight = value;
+			else if (arg == "--width") app->imageWidth = ofToInt(value);
+			else if (arg == "--height") app->imageHeight = ofToInt(value);
+			else if (arg == "--samples") app->samplePts = ofToInt(value);
+			else if (arg == "--threads") app->numThreads = ofToInt(value);
+			else if (arg == "--aa") app->adaptiveMaxSamples = ofToInt(value);
+			else if (arg == "--aa-threshold") app->adaptiveThreshold = ofToFloat(value);
+			else if (arg == "--output") app->path = value;
+			else if (arg == "--profile") app->profileOutput = value;
+			else if (arg == "--bench") app->benchOutput = value;
+			else if (arg == "--serve") app->servePort = ofToInt(value);
+			else if (arg == "--worker-timeout") app->workerTimeout = ofToFloat(value);
+			else if (arg == "--daemon") app->daemonPort = ofToInt(value);
+			else if (arg == "--worker") {
+				size_t colon = value.rfind(':');
+				if (colon == std::string::npos) {
+					cout << "--worker needs <host:port>" << endl;
+					return false;
+				}
+				app->coordinatorHost = value.substr(0, colon);
+				app->coordinatorPort = ofToInt(value.substr(colon + 1));
+			}
+			else {
+				cout << "unknown option: " << arg << endl;
+				return false;
+			}
+		}
+	}
+	if ((app->servePort > 0) + !app->coordinatorHost.empty() + (app->daemonPort > 0) > 1) {
+		cout << "only one of --serve, --worker and --daemon can be given" << endl;
+		return false;
+	}
+	if (app->imageWidth <= 0 || app->imageHeight <= 0 || app->samplePts <= 0 || app->numThreads < 0 || app->adaptiveMaxSamples <= 0) {
+		cout << "width, height, samples and aa must be positive, threads must not be negative" << endl;
+		return false;
+	}
+	return true;
+}
 
 //========================================================================
-int main( ){
+int main(int argc, char *argv[]){
+	if (argc > 1) {
+		// headless: no GL context, setup() renders, saves and quits
+		ofAppNoWindow window;
+		ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
+		ofApp *app = new ofApp();
+		if (!parseArgs(argc, argv, app)) {
+			usage(argv[0]);
+			delete app;
+			return 1;
+		}
+		app->headless = true;
+		return ofRunApp(app);
+	}
+
 	ofSetupOpenGL(1024,768,OF_WINDOW);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
@@ -3,7 +3,44 @@
 //--------------------------------------------------------------
 void ofApp::setup(){
 	ofSetBackgroundColor(ofColor::black);
-	
+	imageSaver.onWritten = [](int64_t start, int64_t end) { Profiler::add(Profiler::Save, start, end); };
+
+	theCam = &mainCam;
+	mainCam.setDistance(20);
+	mainCam.setNearClip(1);
+
+	previewCam.setPosition(renderCam.position);
+	previewCam.lookAt(glm::vec3(0, 0, -1));
+	previewCam.setNearClip(1);
+
+	if (sceneFile.empty()) buildDefaultScene();
+	else {
+		std::string error;
+		if (!loadSceneFile(sceneFile, error)) {
+			cout << error << endl;
+			if (headless) {
+				ofExit(1);
+				return;
+			}
+			buildDefaultScene();
+		}
+	}
+
+	if (!lights.empty()) lightCam.setPosition(lights[0]->position);
+	lightCam.lookAt(glm::vec3(0, 0, 0));
+
+	// the frame buffers are allocated when a render starts, so a streamed
+	// render never holds the full image
+
+	if (headless) renderHeadless();
+}
+
+// The mirror room: a mirror sphere ringed by a hexagon of colored spheres,
+// lit by the ceiling light
+//
+void ofApp::buildDefaultScene() {
+	clearScene();
+
 	// floor
 	scene.push_back(new Plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor(238, 238, 238)));
 	// back wall
@@ -28,24 +65,88 @@ void ofApp::setup(){
 
 
 	lights.push_back(new AreaLight(glm::vec3(0, 12.0, 0), 650.0, ceilingLight));
+}
 
-	theCam = &mainCam;
-	mainCam.setDistance(20);
-	mainCam.setNearClip(1);
+// Replace the scene with one described by a .scene or compiled .scenebin
+// file (see SceneFile.h), relative to the data folder.  The current scene
+// is kept if the file or one of its textures can't be loaded.
+//
+bool ofApp::loadSceneFile(const std::string &file, std::string &error) {
+	SceneDesc desc;
+	if (!loadScene(ofToDataPath(file), desc, error)) return false;
 
-	previewCam.setPosition(glm::vec3(0, 0, 10));
-	previewCam.lookAt(glm::vec3(0, 0, -1));
-	previewCam.setNearClip(1);
+	std::vector < ofImage* > materialTexture(desc.materials.size(), NULL);
+	for (size_t m = 0; m < desc.materials.size(); m++) {
+		if (desc.materials[m].texture < 0) continue;
+		materialTexture[m] = cachedTexture(desc.string(desc.materials[m].texture));
+		if (!materialTexture[m]) {
+			error = std::string("can't load texture ") + desc.string(desc.materials[m].texture);
+			return false;
+		}
+	}
 
-	lightCam.setPosition(lights[0]->position);
-	lightCam.lookAt(glm::vec3(0, 0, 0));
+	clearScene();
+	for (const SceneShape &shape : desc.shapes) {
+		const SceneMaterial &m = desc.materials[shape.material];
+		SceneObject *obj;
+		if (shape.type == SceneShape::Sphere) obj = new Sphere(shape.position, shape.radius, m.diffuse);
+		else obj = new Plane(shape.position, shape.normal, m.diffuse, shape.width, shape.height);
+		obj->specularColor = m.specular;
+		obj->reflectiveness = m.reflectiveness;
+		obj->texture = materialTexture[shape.material];
+		scene.push_back(obj);
+	}
+	for (const SceneLight &light : desc.lights) {
+		lights.push_back(new AreaLight(light.position, light.intensity, desc.string(light.shape)));
+	}
+
+	renderCam.position = desc.camera.position;
+	renderCam.view.setSize(desc.camera.viewMin, desc.camera.viewMax);
+	renderCam.view.position.z = desc.camera.viewZ;
+	previewCam.setPosition(renderCam.position);
+	ambient = desc.ambient;
+	ofSetBackgroundColor(desc.background);
+	sceneKey = desc.hash();
+	return true;
+}
+
+// Textures stay loaded when the scene is replaced, so reloading a scene
+// (or loading another that shares its images) doesn't decode them again.
+// An image edited on disk is loaded again, into the same ofImage, since
+// the objects of the current scene point at it.  returns NULL if the image
+// can't be read; a cached copy is then left as it was.
+//
+ofImage *ofApp::cachedTexture(const std::string &path) {
+	std::error_code ec;
+	int64_t stamp = filesystem::last_write_time(path, ec).time_since_epoch().count();
+	auto found = textureCache.find(path);
+	if (found != textureCache.end() && found->second.stamp == stamp) return found->second.image;
 
-	image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+	ofImage loaded;
+	loaded.setUseTexture(false);     // only sampled on the CPU
+	if (!loaded.load(path)) return NULL;
+
+	CachedTexture &cached = textureCache[path];
+	if (!cached.image) cached.image = new ofImage();
+	*cached.image = std::move(loaded);
+	cached.image->setUseTexture(false);
+	cached.stamp = stamp;
+	return cached.image;
+}
+
+void ofApp::clearScene() {
+	for (SceneObject *obj : scene) delete obj;
+	for (AreaLight *light : lights) delete light;
+	scene.clear();
+	lights.clear();
+	sceneKey = 0;
+	sceneVersion++;
 }
 
 //--------------------------------------------------------------
 void ofApp::update(){
-
+	// upload the progressive render to the texture once per pass
+	if (previewDirty.exchange(false)) image.update();
 }
 
 //--------------------------------------------------------------
@@ -62,6 +163,20 @@ void ofApp::draw(){
 	}
 	renderCam.draw();
 	theCam->end();
+
+	// live view of the progressive render over the preview camera
+	if (theCam == &previewCam && renderStarted) {
+		ofSetColor(ofColor::white);
+		image.draw(0, 0, ofGetWidth(), ofGetHeight());
+		std::string status = rendering ? "pass " + ofToString(renderPass.load() + 1) + " / " + ofToString(progressivePasses) : "done";
+		ofDrawBitmapStringHighlight(status, 10, 20);
+	}
+}
+
+//--------------------------------------------------------------
+void ofApp::exit(){
+	cancelRender = true;
+	if (renderThread.joinable()) renderThread.join();
 }
 
 //--------------------------------------------------------------
@@ -75,7 +190,7 @@ void ofApp::keyPressed(int key){
 		break;
 	case OF_KEY_F3:
 		theCam = &previewCam;
-		rayTrace();
+		startProgressiveRender();
 		break;
 	default:
 		break;
@@ -132,104 +247,1134 @@ void ofApp::dragEvent(ofDragInfo dragInfo){
 
 }
 
+// Render the whole frame at full quality and save it, blocking until done
+//
 void ofApp::rayTrace() {
-	for (int j = 0; j < imageHeight; j++) {
-		if (j % 200 == 0) cout << "y pixel: " << j << endl;
-		for (int i = 0; i < imageWidth; i++) {
-			float u = (i + .5) / imageWidth;
-			float v = (j + .5) / imageHeight;
-			Ray ray = renderCam.getRay(u, v);
-			bool hit = false;
-			float distance = std::numeric_limits<float>::infinity();
-			SceneObject* closestObject = NULL;
-
-			for (SceneObject* obj : scene) {
-				// determine if we hit the object and save closest obj
-				if (obj->intersect(ray, intersectPt, intersectNorm)) {
-					// determine if object is closest
-					float tempDistance = sqrt(pow(intersectPt.x - ray.p.x, 2) + pow(intersectPt.y - ray.p.y, 2) + pow(intersectPt.z - ray.p.z, 2) * 1.0);
-					if (distance > tempDistance) {
-						distance = tempDistance;
-						closestObject = obj;
-					}
+	PROFILE_SCOPE(Profiler::Render);
+	if (streamOutput) {
+		rayTraceStreamed();
+		return;
+	}
+	TilePool pool(numThreads);
+	std::vector<ShadeContext> contexts(pool.size());
+	int tilesX = (imageWidth + tileSize - 1) / tileSize;
+	int tilesY = (imageHeight + tileSize - 1) / tileSize;
+	int totalTiles = tilesX * tilesY;
+	std::atomic<int> tilesDone(0);
+
+	prepareRender();
+	allocateFrame();
+	ofPixels &pixels = image.getPixels();
+
+	// pick up where an interrupted render of the same frame stopped
+	std::vector < char > tileFinished;
+	if (checkpointing) {
+		int restored = journal.resume(ofToDataPath(path.string()), imageWidth, imageHeight, tileSize, renderSettingsKey(), pixels, tileFinished);
+		if (restored > 0) cout << "resuming: " << restored << " / " << totalTiles << " tiles already done" << endl;
+		tilesDone = restored;
+	}
+
+	pool.run(imageWidth, imageHeight, tileSize, [&](const Tile &tile, int worker) {
+		if (checkpointing && tileFinished[journal.tileIndex(tile)]) return;
+		renderTileAdaptive(tile, contexts[worker]);
+		if (checkpointing) {
+			journal.tileDone(journal.tileIndex(tile), tile, pixels);
+			journal.maybeCheckpoint(checkpointInterval);
+		}
+		int done = ++tilesDone;
+		if (done % 200 == 0) cout << "tiles: " << done << " / " << totalTiles << endl;
+	});
+	raysTraced = 0;
+	for (ShadeContext &ctx : contexts) raysTraced += ctx.rays;
+	image.update();
+	imageSaver.save(pixels, path);
+	if (checkpointing) {
+		// the journal is the only copy of the frame until the file is written
+		imageSaver.waitIdle();
+		journal.finish();
+	}
+}
+
+// Command line render: trace the frame, wait until it is on disk and quit.
+// There is no GL context, so the image must never create a texture.
+//
+void ofApp::renderHeadless() {
+	image.setUseTexture(false);
+	if (daemonPort > 0) {
+		serveRenderJobs();
+		ofExit(0);
+		return;
+	}
+	if (!benchOutput.empty()) {
+		runBenchmark();
+		ofExit(0);
+		return;
+	}
+	if (!coordinatorHost.empty()) {
+		// a worker only traces, the coordinator writes the image
+		float start = ofGetElapsedTimef();
+		int tiles = renderWorker();
+		cout << "worker: " << tiles << " tiles in " << ofGetElapsedTimef() - start << "s" << endl;
+		ofExit(tiles >= 0 ? 0 : 1);
+		return;
+	}
+	cout << "rendering " << imageWidth << "x" << imageHeight << ", " << samplePts << " shadow samples, ";
+	if (servePort > 0) cout << "workers on port " << servePort;
+	else cout << TilePool(numThreads).size() << " threads";
+	cout << " -> " << path << endl;
+
+	float start = ofGetElapsedTimef();
+	if (servePort > 0) rayTraceDistributed();
+	else rayTrace();
+	float traced = ofGetElapsedTimef();
+	imageSaver.waitIdle();
+	float saved = ofGetElapsedTimef();
+
+	cout << "trace: " << traced - start << "s, save: " << saved - traced << "s, total: " << saved - start << "s" << endl;
+	if (!profileOutput.empty()) {
+		if (!Profiler::enabled()) cout << "--profile: built without RT_PROFILE, nothing was recorded" << endl;
+		else {
+			Profiler::printSummary(cout);
+			if (!Profiler::writeChromeTrace(ofToDataPath(profileOutput))) cout << "can't write " << profileOutput << endl;
+		}
+	}
+	ofExit(0);
+}
+
+// --bench: time the intersection and texture kernels on seeded random
+// rays, then render the loaded scene (the mirror room unless --scene is
+// given) at a fixed size and sample count, so results stay comparable
+// between builds.  Only --scene, --threads and --output are used.
+//
+void ofApp::runBenchmark() {
+	Benchmark bench("ray-tracer");
+	std::mt19937 rng(Benchmark::seed);
+	std::uniform_real_distribution<float> spread(-1, 1);
+
+	// rays from all around the scene towards a 4 unit box at its center,
+	// so about half of them hit the test shapes
+	const int inputs = 4096;
+	std::vector < Ray > rays;
+	for (int i = 0; i < inputs; i++) {
+		glm::vec3 from = 12.0f * glm::normalize(glm::vec3(spread(rng), spread(rng), spread(rng)) + glm::vec3(0, .01, 0));
+		glm::vec3 to = 2.0f * glm::vec3(spread(rng), spread(rng), spread(rng));
+		rays.push_back(Ray(from, glm::normalize(to - from)));
+	}
+	std::vector < glm::vec3 > spherePoints, planePoints;
+	for (int i = 0; i < inputs; i++) {
+		spherePoints.push_back(1.5f * glm::normalize(glm::vec3(spread(rng), spread(rng), spread(rng)) + glm::vec3(0, 0, .01)));
+		planePoints.push_back(glm::vec3(10 * spread(rng), -2, 10 * spread(rng)));
+	}
+
+	ofImage texture;
+	texture.setUseTexture(false);
+	texture.allocate(512, 512, OF_IMAGE_COLOR);
+	for (int j = 0; j < 512; j++) {
+		for (int i = 0; i < 512; i++) texture.setColor(i, j, ofColor(i / 2, j / 2, (i ^ j) & 255));
+	}
+	Sphere sphere(glm::vec3(0), 1.5);
+	Plane plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0));
+	sphere.texture = &texture;
+	plane.texture = &texture;
+
+	bench.kernel("Sphere::intersect", true, inputs, [&](int i) {
+		HitRecord hit;
+		return sphere.intersect(rays[i], FLT_MAX, hit) ? hit.t : 0.0f;
+	});
+	bench.kernel("Plane::intersect", true, inputs, [&](int i) {
+		HitRecord hit;
+		return plane.intersect(rays[i], FLT_MAX, hit) ? hit.t : 0.0f;
+	});
+	bench.kernel("Sphere::textureLookup", false, inputs, [&](int i) { return (float)sphere.textureLookup(spherePoints[i]).r; });
+	bench.kernel("Plane::textureLookup", false, inputs, [&](int i) { return (float)plane.textureLookup(planePoints[i]).r; });
+
+	bvhVersion = -1;
+	float start = ofGetElapsedTimef();
+	prepareRender();
+	float built = ofGetElapsedTimef();
+	std::string sceneName = sceneFile.empty() ? "mirror-room" : sceneFile;
+	bench.kernel("BVH::closestHit " + sceneName, true, inputs, [&](int i) {
+		HitRecord hit;
+		return bvh.closestHit(rays[i], hit) ? hit.t : 0.0f;
+	});
+	bench.kernel("BVH::anyHit " + sceneName, true, inputs, [&](int i) { return (float)bvh.anyHit(rays[i]); });
+
+	imageWidth = 600;
+	imageHeight = 400;
+	samplePts = 32;
+	adaptiveMinSamples = 4;
+	adaptiveMaxSamples = 16;
+	checkpointing = false;      // a journal of the last run would skip the work
+	streamOutput = false;
+	// the same render with phong()'s shadow rays and then with light samples
+	// shared through reservoirs, to compare their ray counts
+	for (bool reservoirs : { false, true }) {
+		reservoirSampling = reservoirs;
+		float traceStart = ofGetElapsedTimef();
+		rayTrace();
+		float traced = ofGetElapsedTimef();
+		imageSaver.waitIdle();
+		float saved = ofGetElapsedTimef();
+		bench.scene(sceneName + (reservoirs ? " reservoirs" : ""), imageWidth, imageHeight, TilePool(numThreads).size(), raysTraced,
+			{ { "bvh", built - start }, { "trace", traced - traceStart }, { "save", saved - traced } });
+	}
+
+	if (!bench.write(ofToDataPath(benchOutput))) cout << "can't write " << benchOutput << endl;
+}
+
+// Coordinate a render across worker processes (see TileCoordinator.h):
+// the frame is handed out tile by tile to whoever connects on servePort
+// and the returned tiles are assembled, journaled and saved as in
+// rayTrace().  Nothing is traced in this process.
+//
+void ofApp::rayTraceDistributed() {
+	PROFILE_SCOPE(Profiler::Render);
+	allocateFrame();
+	ofPixels &pixels = image.getPixels();
+	int tilesX = (imageWidth + distributedTileSize - 1) / distributedTileSize;
+	int tilesY = (imageHeight + distributedTileSize - 1) / distributedTileSize;
+
+	std::vector < char > tileFinished(tilesX * tilesY, 0);
+	if (checkpointing) {
+		int restored = journal.resume(ofToDataPath(path.string()), imageWidth, imageHeight, distributedTileSize, renderSettingsKey(), pixels, tileFinished);
+		if (restored > 0) cout << "resuming: " << restored << " / " << tilesX * tilesY << " tiles already done" << endl;
+	}
+
+	TileCoordinator coordinator;
+	coordinator.workerTimeout = workerTimeout;
+	bool ok = coordinator.run(servePort, imageWidth, imageHeight, distributedTileSize, renderSettingsKey(), tileFinished,
+		[&](int index, const Tile &tile, const unsigned char *rgb) {
+		size_t rowBytes = size_t(tile.x1 - tile.x0) * 3;
+		for (int j = tile.y0; j < tile.y1; j++) {
+			unsigned char *row = pixels.getData() + (size_t(imageHeight - j - 1) * imageWidth + tile.x0) * 3;
+			memcpy(row, rgb + (j - tile.y0) * rowBytes, rowBytes);
+		}
+		if (checkpointing) {
+			journal.tileDone(index, tile, pixels);
+			journal.maybeCheckpoint(checkpointInterval);
+		}
+	});
+	if (!ok) return;
+	image.update();
+	imageSaver.save(pixels, path);
+	if (checkpointing) {
+		// the journal is the only copy of the frame until the file is written
+		imageSaver.waitIdle();
+		journal.finish();
+	}
+}
+
+// Trace tiles for the coordinator at coordinatorHost:coordinatorPort until
+// it runs out of work.  Each tile is split over the local tile pool.
+//
+// returns the number of tiles traced, -1 if the coordinator couldn't be
+// reached or refused this worker.
+//
+int ofApp::renderWorker() {
+	prepareRender();
+	allocateFrame();
+
+	// workers are often started before the coordinator is up
+	Socket connection;
+	float start = ofGetElapsedTimef();
+	while (!connection.connect(coordinatorHost, coordinatorPort)) {
+		if (ofGetElapsedTimef() - start > 30) {
+			cout << "worker: can't reach " << coordinatorHost << ":" << coordinatorPort << endl;
+			return -1;
+		}
+		ofSleepMillis(500);
+	}
+
+	WorkerHello hello;
+	memcpy(hello.magic, "RTWK", 4);
+	hello.version = TileCoordinator::version;
+	hello.width = imageWidth;
+	hello.height = imageHeight;
+	hello.settingsKey = renderSettingsKey();
+	if (!connection.sendAll(&hello, sizeof(hello))) return -1;
+
+	TilePool pool(numThreads);
+	std::vector<ShadeContext> contexts(pool.size());
+	std::vector < unsigned char > rgb;
+	ofPixels &pixels = image.getPixels();
+	int tiles = 0;
+
+	TileJob job = { 0, { 0, 0, 0, 0 } };
+	while (connection.recvAll(&job, sizeof(job)) && job.index >= 0) {
+		const Tile &tile = job.tile;
+		if (tile.x0 < 0 || tile.y0 < 0 || tile.x1 > imageWidth || tile.y1 > imageHeight || tile.x0 >= tile.x1 || tile.y0 >= tile.y1) break;
+		// tell the coordinator this worker is alive while the tile traces, so
+		// a slow tile isn't taken for a dead worker
+		std::mutex beatLock;
+		std::condition_variable beatStop;
+		bool traced = false;
+		std::thread beat([&] {
+			std::unique_lock<std::mutex> guard(beatLock);
+			while (!beatStop.wait_for(guard, std::chrono::seconds(TileCoordinator::heartbeatSeconds), [&] { return traced; })) {
+				int32_t alive = TileCoordinator::heartbeat;
+				if (!connection.sendAll(&alive, sizeof(alive))) break;
+			}
+		});
+		pool.run(tile.x1 - tile.x0, tile.y1 - tile.y0, tileSize, [&](const Tile &local, int worker) {
+			Tile t = { tile.x0 + local.x0, tile.y0 + local.y0, tile.x0 + local.x1, tile.y0 + local.y1 };
+			renderTileAdaptive(t, contexts[worker]);
+		});
+		{
+			std::lock_guard<std::mutex> guard(beatLock);
+			traced = true;
+		}
+		beatStop.notify_all();
+		beat.join();
+
+		size_t rowBytes = size_t(tile.x1 - tile.x0) * 3;
+		rgb.resize(rowBytes * (tile.y1 - tile.y0));
+		for (int j = tile.y0; j < tile.y1; j++) {
+			const unsigned char *row = pixels.getData() + (size_t(imageHeight - j - 1) * imageWidth + tile.x0) * 3;
+			memcpy(&rgb[(j - tile.y0) * rowBytes], row, rowBytes);
+		}
+		int32_t index = job.index;
+		if (!connection.sendAll(&index, sizeof(index)) || !connection.sendAll(rgb.data(), rgb.size())) break;
+		tiles++;
+	}
+	if (tiles == 0 && job.index < 0) {
+		cout << "worker: coordinator has no work for this scene and settings" << endl;
+	}
+	return tiles;
+}
+
+// Long running render service (headless --daemon).  The scene, its
+// textures, light meshes and BVH stay loaded between jobs, so a job that
+// only moves the camera or changes settings costs just the trace.  Jobs are
+// lines of text on a connection to 127.0.0.1:daemonPort, answered one line
+// each (see runRenderJob()).  Clients are served one at a time.
+//
+void ofApp::serveRenderJobs() {
+	Socket listener;
+	if (!listener.listen(daemonPort, true)) {
+		cout << "render daemon: can't listen on port " << daemonPort << endl;
+		return;
+	}
+	cout << "render daemon: waiting for jobs on 127.0.0.1:" << daemonPort << endl;
+
+	bool quit = false;
+	while (!quit) {
+		Socket client;
+		if (!listener.accept(client, 1)) continue;
+		std::string line;
+		while (!quit && client.recvLine(line)) {
+			std::string reply = runRenderJob(line, quit) + "\n";
+			if (!client.sendAll(reply.data(), reply.size())) break;
+		}
+	}
+}
+
+// One daemon command.  returns the reply, "ok ..." or "error <why>".
+//
+//   render [scene <file>] [camera <x y z>] [view <minx miny maxx maxy z>]
+//          [width <px>] [height <px>] [samples <n>] [threads <n>]
+//          [exposure <e>] [output <path>]
+//       trace a frame and reply once it is on disk:
+//       ok <trace seconds> <save seconds> <output path>
+//       Settings persist - each job only changes what it names.  A job
+//       with a bad option changes nothing, and the camera and view it
+//       names override those of the scene it loads.
+//   quit
+//       stop the daemon
+//
+std::string ofApp::runRenderJob(const std::string &command, bool &quit) {
+	std::istringstream in(command);
+	std::string verb;
+	in >> verb;
+	if (verb == "quit") {
+		quit = true;
+		return "ok bye";
+	}
+	if (verb != "render") return "error unknown command " + verb;
+
+	// parse the whole line before touching the daemon's settings
+	struct JobSettings {
+		std::string scene;
+		bool camera = false, view = false;
+		glm::vec3 position;
+		glm::vec2 viewMin, viewMax;
+		float viewZ;
+		int width, height, samples, threads;
+		float exposure;
+		filesystem::path output;
+	} job;
+	job.scene = sceneFile;
+	job.width = imageWidth;
+	job.height = imageHeight;
+	job.samples = samplePts;
+	job.threads = numThreads;
+	job.exposure = exposure;
+	job.output = path;
+
+	std::string option;
+	while (in >> option) {
+		bool ok = true;
+		if (option == "scene") ok = bool(in >> job.scene);
+		else if (option == "camera") ok = job.camera = bool(in >> job.position.x >> job.position.y >> job.position.z);
+		else if (option == "view") ok = job.view = bool(in >> job.viewMin.x >> job.viewMin.y >> job.viewMax.x >> job.viewMax.y >> job.viewZ);
+		else if (option == "width") ok = in >> job.width && job.width > 0;
+		else if (option == "height") ok = in >> job.height && job.height > 0;
+		else if (option == "samples") ok = in >> job.samples && job.samples > 0;
+		else if (option == "threads") ok = in >> job.threads && job.threads >= 0;
+		else if (option == "exposure") ok = in >> job.exposure && job.exposure > 0;
+		else if (option == "output") {
+			std::string output;
+			ok = bool(in >> output);
+			job.output = output;
+		}
+		else return "error unknown option " + option;
+		if (!ok) return "error bad value for " + option;
+	}
+
+	if (job.scene != sceneFile) {
+		std::string error;
+		if (!loadSceneFile(job.scene, error)) return "error " + error;
+		sceneFile = job.scene;
+	}
+	if (job.camera) renderCam.position = job.position;
+	if (job.view) {
+		renderCam.view.setSize(job.viewMin, job.viewMax);
+		renderCam.view.position.z = job.viewZ;
+	}
+	imageWidth = job.width;
+	imageHeight = job.height;
+	samplePts = job.samples;
+	numThreads = job.threads;
+	exposure = job.exposure;
+	path = job.output;
+	if (scene.empty()) return "error no scene loaded";
+
+	float start = ofGetElapsedTimef();
+	rayTrace();
+	float traced = ofGetElapsedTimef();
+	imageSaver.waitIdle();
+	float saved = ofGetElapsedTimef();
+	return "ok " + ofToString(traced - start) + " " + ofToString(saved - traced) + " " + path.string();
+}
+
+// Everything besides the frame size that changes the pixels of rayTrace(),
+// so a checkpoint from a different render is never resumed
+//
+uint64_t ofApp::renderSettingsKey() {
+	uint64_t key = hashCounter(scene.size() ^ sceneKey);
+	key = hashCounter(key ^ lights.size());
+	key = hashCounter(key ^ samplePts);
+	key = hashCounter(key ^ shadowBatch);
+	key = hashCounter(key ^ lightTreeMinLights);
+	key = hashCounter(key ^ lightTreeSamples);
+	key = hashCounter(key ^ maxReflectionDepth);
+	key = hashCounter(key ^ uint64_t(exposure * 1000));
+	key = hashCounter(key ^ adaptiveMinSamples);
+	key = hashCounter(key ^ adaptiveMaxSamples);
+	key = hashCounter(key ^ adaptiveStep);
+	key = hashCounter(key ^ uint64_t(adaptiveThreshold * 1e6));
+	key = hashCounter(key ^ uint64_t(adaptiveContrast * 1e6));
+	key = hashCounter(key ^ reservoirSampling);
+	key = hashCounter(key ^ reservoirCandidates);
+	key = hashCounter(key ^ reservoirNeighbors);
+	key = hashCounter(key ^ reservoirRadius);
+	auto addFloat = [&key](float f) {
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		key = hashCounter(key ^ bits);
+	};
+	// the camera can change between jobs of the render daemon
+	float camera[] = { renderCam.position.x, renderCam.position.y, renderCam.position.z,
+		renderCam.view.min.x, renderCam.view.min.y, renderCam.view.max.x, renderCam.view.max.y, renderCam.view.position.z };
+	for (float f : camera) addFloat(f);
+	// the emitter meshes as loaded, so a different --light or an edited OBJ
+	// doesn't resume into the old lighting
+	for (const AreaLight *light : lights) {
+		addFloat(light->intensity);
+		for (const glm::vec3 &v : light->verts) {
+			addFloat(v.x);
+			addFloat(v.y);
+			addFloat(v.z);
+		}
+		for (int i : light->tris) key = hashCounter(key ^ uint64_t(i));
+	}
+	// the scene file only names its textures, add the stamps of the images
+	// the objects sample
+	for (const auto &entry : textureCache) {
+		bool used = false;
+		for (const SceneObject *obj : scene) used = used || obj->texture == entry.second.image;
+		if (!used) continue;
+		key = hashCounter(key ^ std::hash<std::string>()(entry.first));
+		key = hashCounter(key ^ uint64_t(entry.second.stamp));
+	}
+	return key;
+}
+
+// Per-render setup that has to happen on the main thread before any
+// worker starts
+//
+void ofApp::prepareRender() {
+	// ofGetBackgroundColor() reads renderer state, only touch it on this thread
+	backgroundColor = ofGetBackgroundColor();
+	// the BVH stays valid until the scene is replaced
+	if (bvhVersion != sceneVersion) {
+		bvh.build(scene);
+		lightTree.build(lights);
+		bvhVersion = sceneVersion;
+	}
+}
+
+// Full frame image and float framebuffer for the in-memory render modes
+//
+void ofApp::allocateFrame() {
+	if (image.getWidth() != imageWidth || image.getHeight() != imageHeight) {
+		image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+	}
+	accum.assign(size_t(imageWidth) * imageHeight, glm::vec3(0));
+}
+
+// Render one row of tiles at a time and stream each finished band to the
+// output file.  Only the band being traced is in memory, so the footprint
+// stays the same whatever the resolution - for poster sized renders.
+//
+void ofApp::rayTraceStreamed() {
+	prepareRender();
+	image.clear();
+	std::vector < glm::vec3 >().swap(accum);
+
+	ScanlineWriter writer;
+	if (!writer.open(ofToDataPath(path.string()), imageWidth, imageHeight)) {
+		cout << "rayTraceStreamed: can't write " << path << ", streamed output must be .ppm or .bmp" << endl;
+		return;
+	}
+
+	TilePool pool(numThreads);
+	std::vector<ShadeContext> contexts(pool.size());
+	std::vector < unsigned char > band(size_t(tileSize) * imageWidth * 3);
+
+	for (int bandY = 0; bandY < imageHeight; bandY += tileSize) {
+		int rows = std::min(tileSize, imageHeight - bandY);
+		pool.run(imageWidth, rows, tileSize, [&](const Tile &local, int worker) {
+			PROFILE_SCOPE(Profiler::Tile);
+			ShadeContext &ctx = contexts[worker];
+			Tile tile = { local.x0, bandY + local.y0, local.x1, bandY + local.y1 };
+			traceTile(tile, ctx);
+			int w = tile.x1 - tile.x0;
+			for (int j = tile.y0; j < tile.y1; j++) {
+				for (int i = tile.x0; i < tile.x1; i++) {
+					ofColor c = toneMap(ctx.tile.sum[(j - tile.y0) * w + (i - tile.x0)]);
+					unsigned char *px = &band[(size_t(j - bandY) * imageWidth + i) * 3];
+					px[0] = c.r;
+					px[1] = c.g;
+					px[2] = c.b;
 				}
-				if (closestObject) { hit = true; }
 			}
-			if (hit) {
-				closestObject->intersect(ray, intersectPt, intersectNorm);
-				ofColor color = phong(intersectPt, intersectNorm, closestObject->diffuseColor, closestObject->specularColor, closestObject->reflectiveness, 40.0);
-				// add ambient lighting value ato phong color
-				image.setColor(i, imageHeight - j - 1, color + (closestObject->diffuseColor * ambient));
+		});
+		// band rows count up from the bottom of the image
+		{
+			PROFILE_SCOPE(Profiler::Save);
+			for (int r = 0; r < rows; r++) {
+				writer.writeRow(imageHeight - (bandY + r) - 1, &band[size_t(r) * imageWidth * 3]);
 			}
-			else { image.setColor(i, imageHeight - j - 1, ofGetBackgroundColor()); }
 		}
+		if ((bandY / tileSize) % 20 == 0) cout << "rows: " << bandY + rows << " / " << imageHeight << endl;
 	}
-	image.save(path, OF_IMAGE_QUALITY_BEST);
+	raysTraced = 0;
+	for (ShadeContext &ctx : contexts) raysTraced += ctx.rays;
+	if (!writer.close()) cout << "rayTraceStreamed: error writing " << path << endl;
 }
 
-ofColor ofApp::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float reflectiveness, float power) {
-	ofColor color = ambient * diffuse;
-	v = normalize(renderCam.position - p);
-	n = normalize(norm);
-	// reflectiveness and diffuseAmount sum to 100%.
-	float diffuseAmount = 1 - reflectiveness;
-	totalIntensity = 0;
+// Kick off a progressive render in the background.  draw() shows the image
+// as it fills in, so the app stays responsive while the render runs.
+//
+void ofApp::startProgressiveRender() {
+	if (rendering) return;
+	if (renderThread.joinable()) renderThread.join();
+	prepareRender();
+	allocateFrame();
+	cancelRender = false;
+	rendering = true;
+	renderStarted = true;
+	renderThread = std::thread(&ofApp::progressiveTrace, this);
+}
 
-	for (AreaLight *light : lights) {
-		
-		for (int i = 0; i < samplePts; i++) {
-			meshPt = light->verts.at(rand() % light->verts.size());
-			l = normalize(meshPt - p);
-			if (!inShadow(Ray((p + .0001*n), l))) {
-				pointIntensity = (light->intensity / pow(glm::distance(meshPt, p), 2)) / samplePts;
-				totalIntensity += pointIntensity;
-				// add diffuse lighting
-				color += (diffuseAmount * diffuse * pointIntensity * glm::dot(n, l));
-
-				// add specular lighting, if not a mirror
-				if (reflectiveness == 0) {
-					h = normalize(v + l);
-					color += (specular * pointIntensity * pow(glm::dot(n, h), power));
+// Coarse passes first - one ray per coarseStep block, then halving the block
+// size until every pixel has its first sample - so a usable picture shows up
+// after a fraction of the work.  After that each pass adds one more jittered
+// sample per pixel to the running average.
+//
+void ofApp::progressiveTrace() {
+	TilePool pool(numThreads);
+	std::vector<ShadeContext> contexts(pool.size());
+
+	for (int pass = 0; pass < progressivePasses && !cancelRender; pass++) {
+		renderPass = pass;
+		int step = pass == 0 ? coarseStep : 1;
+		for (; step >= 1 && !cancelRender; step /= 2) {
+			pool.run(imageWidth, imageHeight, tileSize, [&](const Tile &tile, int worker) {
+				renderTile(tile, contexts[worker], pass, step);
+			});
+			previewDirty = true;
+		}
+	}
+	if (!cancelRender) imageSaver.save(image.getPixels(), path);
+	rendering = false;
+}
+
+// Trace pass number pass over one tile.  With step > 1 only the top left
+// pixel of each step x step block is traced and its color fills the block;
+// pixels already traced by a coarser step are skipped.  Workers write
+// disjoint pixels, so the image pixels can be filled in without locking.
+//
+void ofApp::renderTile(const Tile &tile, ShadeContext &ctx, int pass, int step) {
+	if (cancelRender) return;
+	PROFILE_SCOPE(Profiler::Tile);
+	ofPixels &pixels = image.getPixels();
+	int firstY = (tile.y0 + step - 1) / step * step;
+	int firstX = (tile.x0 + step - 1) / step * step;
+	for (int j = firstY; j < tile.y1; j += step) {
+		for (int i = firstX; i < tile.x1; i += step) {
+			bool tracedCoarser = step < coarseStep && pass == 0 && i % (2 * step) == 0 && j % (2 * step) == 0;
+			if (tracedCoarser) continue;
+
+			size_t index = size_t(j) * imageWidth + i;
+			ctx.sampler.startPixel(index, pass);
+
+			// the first sample goes through the pixel center, later ones are
+			// jittered across the pixel
+			float jx = pass == 0 ? .5 : ctx.sampler.random(0, 4);
+			float jy = pass == 0 ? .5 : ctx.sampler.random(0, 5);
+			glm::vec3 color = tracePixel(ctx, (i + jx) / imageWidth, (j + jy) / imageHeight);
+
+			if (pass == 0) accum[index] = color;
+			else accum[index] += color;
+			ofColor out = toneMap(accum[index] / float(pass + 1));
+
+			for (int y = j; y < std::min(j + step, tile.y1); y++) {
+				for (int x = i; x < std::min(i + step, tile.x1); x++) {
+					pixels.setColor(x, imageHeight - y - 1, out);
 				}
 			}
 		}
 	}
-	// add mirror lighting, if a mirror
-	if (reflectiveness != 0) {
-		// calculate reflect ray
-		reflectRay = new Ray(p, normalize(2 * glm::dot(n, v) * n - v));
+}
 
+// Linear color seen through the view plane at (u, v)
+//
+glm::vec3 ofApp::tracePixel(ShadeContext &ctx, float u, float v) {
+	Ray ray = renderCam.getRay(u, v);
+	HitRecord hit;
+	{
+		PROFILE_SCOPE(Profiler::Primary);
+		PROFILE_COUNT(Profiler::PrimaryRays, 1);
+		bvh.closestHit(ray, hit);
+	}
+	ctx.rays++;
+	return primaryColor(ctx, ray, hit);
+}
 
-		// ray trace it using above method
+// Color of a primary ray given its closest hit (hit.object is NULL on a
+// miss)
+//
+glm::vec3 ofApp::primaryColor(ShadeContext &ctx, const Ray &ray, const HitRecord &hit) {
+	if (hit.object) {
+		glm::vec3 color = shade(ctx, ray, hit);
+		// add ambient lighting value ato phong color
+		return color + (hit.material.diffuse * toFloatColor(ambient));
+	}
+	return toFloatColor(backgroundColor);
+}
+
+// Pixel centered colors of the nx x ny block of pixels at (x0, y0), traced
+// as one ray packet.  colors is row major, nx wide.
+//
+void ofApp::traceBlock(ShadeContext &ctx, int x0, int y0, int nx, int ny, glm::vec3 *colors) {
+	RayPacket packet;
+	HitRecord hits[RayPacket::size];
+	renderCam.getPacket(packet, x0, y0, nx, ny, imageWidth, imageHeight);
+	{
+		PROFILE_SCOPE(Profiler::Primary);
+		PROFILE_COUNT(Profiler::PrimaryRays, packet.count);
+		bvh.closestHitPacket(packet, hits);
+	}
+	ctx.rays += packet.count;
+	for (int k = 0; k < packet.count; k++) {
+		int i = x0 + k % nx;
+		int j = y0 + k / nx;
+		ctx.sampler.startPixel(size_t(j) * imageWidth + i, 0);
+		colors[k] = primaryColor(ctx, packet.ray(k), hits[k]);
+	}
+}
 
-		bool hit = false;
-		float distance = std::numeric_limits<float>::infinity();
-		SceneObject* closestObject = NULL;
+// Final color of every pixel of a tile into accum and the image
+//
+void ofApp::renderTileAdaptive(const Tile &tile, ShadeContext &ctx) {
+	if (cancelRender) return;
+	PROFILE_SCOPE(Profiler::Tile);
+	ofPixels &pixels = image.getPixels();
+	traceTile(tile, ctx);
+	int w = tile.x1 - tile.x0;
+	for (int j = tile.y0; j < tile.y1; j++) {
+		for (int i = tile.x0; i < tile.x1; i++) {
+			const glm::vec3 &color = ctx.tile.sum[(j - tile.y0) * w + (i - tile.x0)];
+			accum[size_t(j) * imageWidth + i] = color;
+			pixels.setColor(i, imageHeight - j - 1, toneMap(color));
+		}
+	}
+}
 
-		for (SceneObject* obj : scene) {
-			// determine if we hit the object and save closest obj
-			if (obj->intersect(*reflectRay, intersectPt, intersectNorm)) {
-				// determine if object is closest
-				float tempDistance = sqrt(pow(intersectPt.x - reflectRay->p.x, 2) + pow(intersectPt.y - reflectRay->p.y, 2) + pow(intersectPt.z - reflectRay->p.z, 2) * 1.0);
-				if (distance > tempDistance) {
-					distance = tempDistance;
-					closestObject = obj;
+// Adaptive supersampling of one tile, leaving the mean color of each pixel
+// in ctx.tile.sum (tile local, row major).
+//
+// The pixel centers go first, traced as 8x8 packets.  Every pixel then gets
+// jittered samples up to adaptiveMinSamples, and after that rounds of
+// adaptiveStep more go only to pixels that still look unresolved: the
+// standard error of their mean brightness is above adaptiveThreshold, or
+// they differ from a neighbor by more than adaptiveContrast (an edge whose
+// first samples all happened to land on one side).  No pixel takes more
+// than adaptiveMaxSamples.  Brightness is measured after exposure and
+// clamped to white, so noise in overexposed areas doesn't draw samples.
+//
+// Neighbors are only looked up inside the tile, other workers may be
+// writing the pixels around it.
+//
+// With reservoirSampling every sample is taken by resampleTile() instead,
+// one pass over the tile per sample so pixels can share light samples.
+//
+void ofApp::traceTile(const Tile &tile, ShadeContext &ctx) {
+	int w = tile.x1 - tile.x0;
+	int h = tile.y1 - tile.y0;
+	TileSamples &ts = ctx.tile;
+	ts.sum.assign(w * h, glm::vec3(0));
+	ts.lum.assign(w * h, 0);
+	ts.lumSq.assign(w * h, 0);
+	ts.count.assign(w * h, 0);
+	ts.refine.assign(w * h, 0);
+
+	auto record = [&](int k, const glm::vec3 &color) {
+		float y = std::min(glm::dot(color, glm::vec3(.2126, .7152, .0722)) * exposure, 1.0f);
+		ts.sum[k] += color;
+		ts.lum[k] += y;
+		ts.lumSq[k] += y * y;
+		ts.count[k]++;
+	};
+
+	// next sample of every pixel in ts.active, all at once
+	auto resamplePass = [&]() {
+		resampleTile(tile, ctx);
+		for (int k = 0; k < w * h; k++) {
+			if (ts.active[k]) record(k, ts.color[k]);
+		}
+	};
+
+	if (reservoirSampling) {
+		ts.active.assign(w * h, 1);
+		resamplePass();
+	}
+	else {
+		glm::vec3 colors[RayPacket::size];
+		for (int y0 = tile.y0; y0 < tile.y1; y0 += RayPacket::width) {
+			for (int x0 = tile.x0; x0 < tile.x1; x0 += RayPacket::width) {
+				int nx = std::min(RayPacket::width, tile.x1 - x0);
+				int ny = std::min(RayPacket::width, tile.y1 - y0);
+				traceBlock(ctx, x0, y0, nx, ny, colors);
+				for (int k = 0; k < nx * ny; k++) {
+					record((y0 - tile.y0 + k / nx) * w + (x0 - tile.x0 + k % nx), colors[k]);
 				}
 			}
-			if (closestObject) { hit = true; }
 		}
-		if (hit) {
-			closestObject->intersect(*reflectRay, intersectPt, intersectNorm);
-			color += reflectiveness * totalIntensity * phong(intersectPt, intersectNorm, closestObject->diffuseColor, closestObject->specularColor, closestObject->reflectiveness, 40.0);
+	}
+	if (adaptiveMaxSamples <= 1) return;
+
+	// jittered sample number pass of pixel (i, j), seeded like the
+	// progressive passes
+	auto addSample = [&](int i, int j, int pass) {
+		int k = (j - tile.y0) * w + (i - tile.x0);
+		ctx.sampler.startPixel(size_t(j) * imageWidth + i, pass);
+		float jx = ctx.sampler.random(0, 4);
+		float jy = ctx.sampler.random(0, 5);
+		record(k, tracePixel(ctx, (i + jx) / imageWidth, (j + jy) / imageHeight));
+	};
+
+	int minSamples = std::min(adaptiveMinSamples, adaptiveMaxSamples);
+	if (reservoirSampling) {
+		for (int pass = 1; pass < minSamples; pass++) resamplePass();
+	}
+	else {
+		for (int j = tile.y0; j < tile.y1; j++) {
+			for (int i = tile.x0; i < tile.x1; i++) {
+				for (int pass = 1; pass < minSamples; pass++) addSample(i, j, pass);
+			}
+		}
+	}
+
+	while (!cancelRender) {
+		int flagged = 0;
+		for (int k = 0; k < w * h; k++) {
+			int n = ts.count[k];
+			ts.refine[k] = 0;
+			if (n >= adaptiveMaxSamples) continue;
+			float mean = ts.lum[k] / n;
+			float variance = std::max(ts.lumSq[k] - n * mean * mean, 0.0f) / std::max(n - 1, 1);
+			bool noisy = n > 1 && variance > adaptiveThreshold * adaptiveThreshold * n;
+
+			bool edge = false;
+			int x = k % w, y = k / w;
+			const int dx[] = { -1, 1, 0, 0 }, dy[] = { 0, 0, -1, 1 };
+			for (int d = 0; d < 4 && !edge; d++) {
+				int nxp = x + dx[d], nyp = y + dy[d];
+				if (nxp < 0 || nyp < 0 || nxp >= w || nyp >= h) continue;
+				int nk = nyp * w + nxp;
+				edge = std::abs(mean - ts.lum[nk] / ts.count[nk]) > adaptiveContrast;
+			}
+			ts.refine[k] = noisy || edge;
+			flagged += ts.refine[k];
 		}
-		else {
-			// placeholder, nothing for now
+		if (flagged == 0) break;
+		if (reservoirSampling) {
+			// the flagged pixels share light samples among themselves
+			for (int step = 0; step < adaptiveStep; step++) {
+				for (int k = 0; k < w * h; k++) ts.active[k] = ts.refine[k] && ts.count[k] < adaptiveMaxSamples;
+				resamplePass();
+			}
+			continue;
+		}
+		for (int k = 0; k < w * h; k++) {
+			if (!ts.refine[k]) continue;
+			int i = tile.x0 + k % w, j = tile.y0 + k / w;
+			int last = std::min(ts.count[k] + adaptiveStep, adaptiveMaxSamples);
+			for (int pass = ts.count[k]; pass < last; pass++) addSample(i, j, pass);
+		}
+	}
+	for (int k = 0; k < w * h; k++) ts.sum[k] /= float(ts.count[k]);
+}
+
+// Light a point x on lights[l] sends to hit toward v if nothing is in the
+// way, the term phong() adds for it on a surface that isn't a mirror.  Zero
+// when x is below the horizon, where phong() would still add a little
+// specular.
+//
+static glm::vec3 lightContribution(const AreaLight *light, const HitRecord &hit, const glm::vec3 &n, const glm::vec3 &v,
+	const glm::vec3 &x, float power) {
+	glm::vec3 d = x - hit.point;
+	float d2 = glm::length2(d);
+	if (d2 <= 0) return glm::vec3(0);
+	glm::vec3 l = d / sqrtf(d2);
+	float ndotl = glm::dot(n, l);
+	if (ndotl <= 0) return glm::vec3(0);
+	float cosH = std::max(glm::dot(n, glm::normalize(v + l)), 0.0f);
+	return light->intensity / d2 * (hit.material.diffuse * ndotl + hit.material.specular * powf(cosH, power));
+}
+
+// The next sample (ts.count[k]) of each pixel k in ts.active into ts.color,
+// with the direct light of surfaces that aren't mirrors estimated from
+// light samples reused between neighboring pixels, in the style of ReSTIR
+// (Bitterli et al. 2020), instead of phong()'s shadow rays:
+//
+//   1. each pixel streams reservoirCandidates unshadowed light samples
+//      through a reservoir that keeps one of them with probability
+//      proportional to the light it adds, then traces one shadow ray to it
+//   2. each pixel merges its own reservoir with those of reservoirNeighbors
+//      random pixels of the pass up to reservoirRadius away whose surface
+//      faces the same way at about the same depth, reweighting their samples
+//      for its own surface
+//   3. one more shadow ray to the sample it ends up with
+//
+// So a pixel draws on up to (1 + reservoirNeighbors) * reservoirCandidates
+// light samples for two shadow rays.  This is the paper's biased merge: it
+// counts a neighbor's candidates in full and trusts its visibility, which
+// darkens penumbrae and grazing light a little where neighbors disagree.
+// Misses and reflective surfaces are shaded by primaryColor() as usual.
+//
+// Pixel centers for sample 0, jittered after that, seeded like
+// traceTile()'s other samples.
+//
+void ofApp::resampleTile(const Tile &tile, ShadeContext &ctx) {
+	const float power = 40.0;    // what shade() gives phong()
+	int w = tile.x1 - tile.x0;
+	int h = tile.y1 - tile.y0;
+	TileSamples &ts = ctx.tile;
+	ts.hits.resize(w * h);
+	ts.dirs.resize(w * h);
+	ts.color.resize(w * h);
+	ts.reservoirs.assign(w * h, LightReservoir());
+
+	int lightCount = lights.size();
+	bool useTree = lightCount >= lightTreeMinLights && !lightTree.empty();
+	auto target = [](const glm::vec3 &f) { return glm::dot(f, glm::vec3(.2126, .7152, .0722)); };
+	auto resampled = [&](int k) {
+		return ts.active[k] && ts.hits[k].object && ts.hits[k].material.reflectiveness == 0 && lightCount > 0;
+	};
+	auto visible = [&](const glm::vec3 &p, const glm::vec3 &n, const glm::vec3 &x) {
+		ctx.rays++;
+		return !inShadow(p, n, x);
+	};
+
+	// primary hits and candidates
+	for (int k = 0; k < w * h; k++) {
+		if (!ts.active[k]) continue;
+		int i = tile.x0 + k % w, j = tile.y0 + k / w;
+		int pass = ts.count[k];
+		ctx.sampler.startPixel(size_t(j) * imageWidth + i, pass);
+		float jx = pass ? ctx.sampler.random(0, 4) : .5f;
+		float jy = pass ? ctx.sampler.random(0, 5) : .5f;
+		Ray ray = renderCam.getRay((i + jx) / imageWidth, (j + jy) / imageHeight);
+		HitRecord &hit = ts.hits[k];
+		hit = HitRecord();
+		{
+			PROFILE_SCOPE(Profiler::Primary);
+			PROFILE_COUNT(Profiler::PrimaryRays, 1);
+			bvh.closestHit(ray, hit);
+		}
+		ctx.rays++;
+		ts.dirs[k] = ray.d;
+		if (!resampled(k)) continue;
+
+		PROFILE_SCOPE(Profiler::Phong);
+		glm::vec3 n = glm::normalize(hit.normal);
+		LightReservoir &r = ts.reservoirs[k];
+		ctx.sampler.nextDimension();
+		for (int c = 0; c < reservoirCandidates; c++) {
+			// the candidate's pdf is that of its light, its point is uniform
+			// over the light as in phong()
+			float pdf = 1.0f / lightCount;
+			int pick;
+			if (useTree) pick = lightTree.sample(hit.point, n, ctx.sampler.get1D(c), pdf);
+			else pick = std::min(int(ctx.sampler.get1D(c) * lightCount), lightCount - 1);
+			glm::vec3 x = lights[pick]->samplePoint(ctx.sampler.get2D(c));
+			float weight = target(lightContribution(lights[pick], hit, n, -ray.d, x, power)) / pdf;
+			r.update(x, pick, weight, ctx.sampler.random(c, 6));
 		}
+		r.m = reservoirCandidates;
+		if (r.light < 0) continue;
+		// a sample this pixel doesn't see is of no use to its neighbors either
+		float p = target(lightContribution(lights[r.light], hit, n, -ray.d, r.y, power));
+		r.W = visible(hit.point, n, r.y) ? r.wSum / (r.m * p) : 0;
 	}
 
-	// L = L ambient + L diffuse + L specular + L mirror
+	// merge and shade
+	for (int k = 0; k < w * h; k++) {
+		if (!ts.active[k]) continue;
+		int x = k % w, y = k / w;
+		int i = tile.x0 + x, j = tile.y0 + y;
+		const HitRecord &hit = ts.hits[k];
+		ctx.sampler.startPixel(size_t(j) * imageWidth + i, ts.count[k]);
+		if (!resampled(k)) {
+			ts.color[k] = primaryColor(ctx, Ray(renderCam.position, ts.dirs[k]), hit);
+			continue;
+		}
+
+		PROFILE_SCOPE(Profiler::Phong);
+		glm::vec3 n = glm::normalize(hit.normal);
+		glm::vec3 v = -ts.dirs[k];
+		LightReservoir s;
+		for (int q = 0; q <= reservoirNeighbors; q++) {
+			int nk = k;
+			if (q > 0) {
+				int size = 2 * reservoirRadius + 1;
+				int nx = x + std::min(int(ctx.sampler.random(q, 7) * size), size - 1) - reservoirRadius;
+				int ny = y + std::min(int(ctx.sampler.random(q, 8) * size), size - 1) - reservoirRadius;
+				if (nx < 0 || ny < 0 || nx >= w || ny >= h) continue;
+				nk = ny * w + nx;
+				if (nk == k || !resampled(nk)) continue;
+				const HitRecord &other = ts.hits[nk];
+				if (glm::dot(n, glm::normalize(other.normal)) < .9f || std::abs(other.t - hit.t) > .1f * hit.t) continue;
+			}
+			const LightReservoir &r = ts.reservoirs[nk];
+			if (r.light >= 0 && r.W > 0) {
+				float p = target(lightContribution(lights[r.light], hit, n, v, r.y, power));
+				s.update(r.y, r.light, p * r.W * r.m, ctx.sampler.random(q, 9));
+			}
+			s.m += r.m;
+		}
+
+		// ambient as phong() and primaryColor() add it
+		glm::vec3 color = 2.0f * toFloatColor(ambient) * hit.material.diffuse;
+		if (s.light >= 0) {
+			glm::vec3 f = lightContribution(lights[s.light], hit, n, v, s.y, power);
+			float p = target(f);
+			if (p > 0 && visible(hit.point, n, s.y)) color += f * (s.wSum / (s.m * p));
+		}
+		ts.color[k] = color;
+	}
+}
+
+// The one place float color becomes 8 bit: scale by exposure, clamp, round
+//
+ofColor ofApp::toneMap(const glm::vec3 &c) {
+	glm::vec3 q = c * exposure * 255.0f + .5f;
+	return ofColor(glm::clamp(q.x, 0.0f, 255.0f), glm::clamp(q.y, 0.0f, 255.0f), glm::clamp(q.z, 0.0f, 255.0f));
+}
+
+// Follow a ray through up to maxReflectionDepth mirror bounces.  Each hit
+// adds its direct lighting scaled by the throughput of the bounces before
+// it, so the loop runs on the stack and stops as soon as the reflected
+// contribution can no longer change the pixel.
+//
+glm::vec3 ofApp::shade(ShadeContext &ctx, const Ray &primary, const HitRecord &primaryHit) {
+	glm::vec3 color(0);
+	Ray ray = primary;
+	HitRecord hit = primaryHit;
+	float throughput = 1.0;
+
+	for (int depth = 0; ; depth++) {
+		color += throughput * phong(ctx, hit, -ray.d, 40.0);
+
+		// L = L ambient + L diffuse + L specular + L mirror
+		float reflectiveness = hit.material.reflectiveness;
+		if (reflectiveness == 0 || depth >= maxReflectionDepth) break;
+		throughput *= reflectiveness * ctx.totalIntensity;
+		if (throughput < minThroughput) break;
+
+		// calculate reflect ray, lifted off the surface like the shadow rays
+		ray = Ray(hit.point + .0001 * ctx.n, normalize(2 * glm::dot(ctx.n, ctx.v) * ctx.n - ctx.v));
+		PROFILE_SCOPE(Profiler::Reflect);
+		PROFILE_COUNT(Profiler::ReflectRays, 1);
+		ctx.rays++;
+		if (!bvh.closestHit(ray, hit)) break;
+	}
 	return color;
+}
+
+// Light from count samples of one light, everything in flat float arrays.
+// Shadowed samples are masked to zero instead of branched around, and each
+// sum is kept per lane, so the loops compile to packed SIMD without needing
+// the compiler to reorder a float reduction.  pow() sits in a loop of its own
+// so the main loop vectorizes even where the math library has no SIMD pow;
+// that one vectorizes too under /fp:fast or -ffast-math.
+//
+static void shadeLightSamples(LightSamples &s, int count, const glm::vec3 &p, const glm::vec3 &n, const glm::vec3 &v,
+	float intensity, float power, bool specular, float &diffuseSum, float &specularSum, float &intensitySum) {
+	const int lanes = LightSamples::lanes;
+	float diffuseLane[lanes] = {}, specularLane[lanes] = {}, intensityLane[lanes] = {};
+	const float *sx = s.x.data(), *sy = s.y.data(), *sz = s.z.data(), *vis = s.visible.data();
+	float *weight = s.weight.data(), *cosH = s.cosH.data();
+
+	for (int base = 0; base < count; base += lanes) {
+		for (int k = 0; k < lanes; k++) {
+			int i = base + k;
+			float dx = sx[i] - p.x, dy = sy[i] - p.y, dz = sz[i] - p.z;
+			float d2 = dx * dx + dy * dy + dz * dz;
+			float invD = 1.0f / sqrtf(d2);
+			float lx = dx * invD, ly = dy * invD, lz = dz * invD;
+			float pointIntensity = vis[i] * intensity / d2;
+
+			float ndotl = std::max(n.x * lx + n.y * ly + n.z * lz, 0.0f);
+
+			float hx = v.x + lx, hy = v.y + ly, hz = v.z + lz;
+			float invH = 1.0f / sqrtf(hx * hx + hy * hy + hz * hz);
+
+			intensityLane[k] += pointIntensity;
+			diffuseLane[k] += pointIntensity * ndotl;
+			weight[i] = pointIntensity;
+			cosH[i] = std::max((n.x * hx + n.y * hy + n.z * hz) * invH, 0.0f);
+		}
+	}
+	if (specular) {
+		for (int base = 0; base < count; base += lanes) {
+			for (int k = 0; k < lanes; k++) {
+				specularLane[k] += weight[base + k] * powf(cosH[base + k], power);
+			}
+		}
+	}
 
+	diffuseSum = specularSum = intensitySum = 0;
+	for (int k = 0; k < lanes; k++) {
+		diffuseSum += diffuseLane[k];
+		specularSum += specularLane[k];
+		intensitySum += intensityLane[k];
+	}
+}
+
+// Direct lighting at a hit seen from direction v.  Also leaves the shading
+// normal, view vector and total light intensity in ctx for the mirror bounce.
+//
+glm::vec3 ofApp::phong(ShadeContext &ctx, const HitRecord &hit, const glm::vec3 &v, float power) {
+	PROFILE_SCOPE(Profiler::Phong);
+	const glm::vec3 &p = hit.point;
+	const glm::vec3 &diffuse = hit.material.diffuse;
+	const glm::vec3 &specular = hit.material.specular;
+	float reflectiveness = hit.material.reflectiveness;
+	glm::vec3 color = toFloatColor(ambient) * diffuse;
+	ctx.v = v;
+	ctx.n = normalize(hit.normal);
+	// reflectiveness and diffuseAmount sum to 100%.
+	float diffuseAmount = 1 - reflectiveness;
+	ctx.totalIntensity = 0;
+
+	LightSamples &samples = ctx.samples;
+	samples.reserve(std::max(samplePts, lightTreeSamples));
+
+	// shade taken samples of samples with lights of the given intensity
+	auto addSamples = [&](int taken, float intensity) {
+		// pad the last group of lanes with harmless masked out samples
+		int padded = (taken + LightSamples::lanes - 1) / LightSamples::lanes * LightSamples::lanes;
+		for (int i = taken; i < padded; i++) {
+			samples.x[i] = p.x + ctx.n.x;
+			samples.y[i] = p.y + ctx.n.y;
+			samples.z[i] = p.z + ctx.n.z;
+			samples.visible[i] = 0;
+		}
+
+		float diffuseSum, specularSum, intensitySum;
+		shadeLightSamples(samples, taken, p, ctx.n, ctx.v, intensity, power, reflectiveness == 0, diffuseSum, specularSum, intensitySum);
+
+		ctx.totalIntensity += intensitySum / taken;
+		color += diffuseAmount * diffuse * (diffuseSum / taken);
+		// specular lighting, if not a mirror
+		if (reflectiveness == 0) color += specular * (specularSum / taken);
+	};
+
+	// many lights: a fixed budget of shadow rays shared by all of them, each
+	// to a light picked by the light tree.  A sample carries its light's
+	// intensity over the probability that light was picked, so the average
+	// is the sum over all lights.
+	//
+	if ((int)lights.size() >= lightTreeMinLights && !lightTree.empty()) {
+		ctx.sampler.nextDimension();
+		int visible = 0;
+		for (int i = 0; i < lightTreeSamples; i++) {
+			float pdf;
+			int pick = lightTree.sample(p, ctx.n, ctx.sampler.get1D(i), pdf);
+			const AreaLight *light = lights[pick];
+			ctx.meshPt = light->samplePoint(ctx.sampler.get2D(i));
+			ctx.l = normalize(ctx.meshPt - p);
+			bool lit = !inShadow(p, ctx.n, ctx.meshPt);
+			samples.x[i] = ctx.meshPt.x;
+			samples.y[i] = ctx.meshPt.y;
+			samples.z[i] = ctx.meshPt.z;
+			samples.visible[i] = lit ? light->intensity / pdf : 0.0f;
+			visible += lit;
+		}
+		ctx.rays += lightTreeSamples;
+		if (visible > 0) addSamples(lightTreeSamples, 1.0f);
+		return color;
+	}
+
+	for (AreaLight *light : lights) {
+		ctx.sampler.nextDimension();
+		int taken = 0, visible = 0;
+
+		// shoot a first batch of shadow rays.  If they all agree the point is
+		// fully lit or fully in shadow, take their average; only points in a
+		// penumbra go on to use the whole samplePts budget.
+		//
+		int budget = std::min(shadowBatch, samplePts);
+		while (taken < budget) {
+			ctx.meshPt = light->samplePoint(ctx.sampler.get2D(taken));
+			ctx.l = normalize(ctx.meshPt - p);
+			bool lit = !inShadow(p, ctx.n, ctx.meshPt);
+			samples.x[taken] = ctx.meshPt.x;
+			samples.y[taken] = ctx.meshPt.y;
+			samples.z[taken] = ctx.meshPt.z;
+			samples.visible[taken] = lit ? 1.0f : 0.0f;
+			visible += lit;
+			taken++;
+			if (taken == budget && visible != 0 && visible != taken) budget = samplePts;
+		}
+		ctx.rays += taken;
+		if (visible > 0) addSamples(taken, light->intensity);
+	}
+	return color;
 }
 
 
@@ -237,51 +1382,105 @@ ofColor ofApp::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor di
 
 // use point sleightly above surface of object = .0001
 // lift in normal direction
-bool ofApp::inShadow(Ray r) {
-	glm::vec3 intersectPtShade;
-	glm::vec3 intersectNormShade;
-	for (SceneObject* sObject : scene) {
-		if (sObject->intersect(r, intersectPtShade, intersectNormShade)) { return true; }
-	}
-	return false;
+//
+// Only what lies between p and the light point x blocks it; the ray stops
+// just short of x so walls and objects beyond the light don't count.
+//
+bool ofApp::inShadow(const glm::vec3 &p, const glm::vec3 &n, const glm::vec3 &x) {
+	PROFILE_SCOPE(Profiler::Shadow);
+	PROFILE_COUNT(Profiler::ShadowRays, 1);
+	glm::vec3 origin = p + .0001f * n;
+	glm::vec3 d = x - origin;
+	float dist = glm::length(d);
+	if (dist <= .0001f) return false;
+	return bvh.anyHit(Ray(origin, d / dist), dist - .0001f);
 }
 
 // Intersect Ray with Plane  (wrapper on glm::intersect*
 //
-bool Plane::intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normalAtIntersect) {
+bool Plane::intersect(const Ray &ray, float tMax, HitRecord &hit) {
 	float dist;
 	bool insidePlane = false;
-	bool hit = glm::intersectRayPlane(ray.p, ray.d, position, this->normal, dist);
-	if (hit) {
-		Ray r = ray;
-		point = r.evalPoint(dist);
-		normalAtIntersect = this->normal;
-		glm::vec2 xrange = glm::vec2(position.x - width / 2, position.x + width / 2);
-		glm::vec2 zrange = glm::vec2(position.z - height / 2, position.z + height / 2);
-		if (point.x < xrange[1] && point.x > xrange[0] && point.z < zrange[1] && point.z > zrange[0]) {
+	// reject anything behind the current closest hit before clipping
+	if (glm::intersectRayPlane(ray.p, ray.d, position, this->normal, dist) && dist < tMax) {
+		glm::vec3 point = ray.evalPoint(dist);
+		if (insidePlaneExtent(point, position, normal, width, height)) {
 			insidePlane = true;
+			hit.t = dist;
+			hit.point = point;
+			hit.normal = this->normal;
+			hit.object = this;
 		}
 	}
 	return insidePlane;
 }
 
-bool MirrorPlane::intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normalAtIntersect) {
+// the texture repeats every textureLength units across the plane, laid out
+// on the two world axes the plane is most aligned with
+//
+ofColor Plane::textureLookup(const glm::vec3 &p) {
+	glm::vec3 n = glm::abs(normal);
+	glm::vec2 uv;
+	if (n.y >= n.x && n.y >= n.z) uv = glm::vec2(p.x + width / 2, p.z + height / 2);
+	else if (n.x >= n.z) uv = glm::vec2(p.z, p.y);
+	else uv = glm::vec2(p.x, p.y);
+
+	uv = glm::mod(uv, glm::vec2(textureLength)) / textureLength;
+	int w = texture->getWidth();
+	int h = texture->getHeight();
+	int i = ofClamp(uv.x * w, 0, w - 1);
+	int j = ofClamp(uv.y * h, 0, h - 1);
+	return texture->getColor(i, j);
+}
+
+// box around the corners of the plane's extent (see planeExtentAxes()).
+// The x/z corners of a sloped plane are lifted onto it; one close to
+// vertical can reach so far up that it is left unbounded.
+//
+bool planeBounds(const glm::vec3 &position, const glm::vec3 &normal, float width, float height, glm::vec3 &bmin, glm::vec3 &bmax) {
+	glm::vec3 u, v;
+	planeExtentAxes(normal, u, v);
+	bmin = glm::vec3(FLT_MAX);
+	bmax = glm::vec3(-FLT_MAX);
+	for (int i = 0; i < 4; i++) {
+		glm::vec3 corner = position + (i & 1 ? .5f : -.5f) * width * u + (i & 2 ? .5f : -.5f) * height * v;
+		if (normal.y != 0) corner.y = position.y - (normal.x * (corner.x - position.x) + normal.z * (corner.z - position.z)) / normal.y;
+		bmin = glm::min(bmin, corner);
+		bmax = glm::max(bmax, corner);
+	}
+	bmin -= glm::vec3(.0001);
+	bmax += glm::vec3(.0001);
+	for (int axis = 0; axis < 3; axis++) {
+		if (!std::isfinite(bmin[axis]) || !std::isfinite(bmax[axis])) return false;
+	}
+	return true;
+}
+
+bool Plane::getBounds(glm::vec3 &bmin, glm::vec3 &bmax) {
+	return planeBounds(position, normal, width, height, bmin, bmax);
+}
+
+bool MirrorPlane::intersect(const Ray &ray, float tMax, HitRecord &hit) {
 	float dist;
 	bool insidePlane = false;
-	bool hit = glm::intersectRayPlane(ray.p, ray.d, position, this->normal, dist);
-	if (hit) {
-		Ray r = ray;
-		point = r.evalPoint(dist);
-		normalAtIntersect = this->normal;
-		glm::vec2 xrange = glm::vec2(position.x - width / 2, position.x + width / 2);
-		glm::vec2 zrange = glm::vec2(position.z - height / 2, position.z + height / 2);
-		if (point.x < xrange[1] && point.x > xrange[0] && point.z < zrange[1] && point.z > zrange[0]) {
+	// reject anything behind the current closest hit before clipping
+	if (glm::intersectRayPlane(ray.p, ray.d, position, this->normal, dist) && dist < tMax) {
+		glm::vec3 point = ray.evalPoint(dist);
+		if (insidePlaneExtent(point, position, normal, width, height)) {
 			insidePlane = true;
+			hit.t = dist;
+			hit.point = point;
+			hit.normal = this->normal;
+			hit.object = this;
 		}
 	}
 	return insidePlane;
 }
 
+bool MirrorPlane::getBounds(glm::vec3 &bmin, glm::vec3 &bmax) {
+	return planeBounds(position, normal, width, height, bmin, bmax);
+}
+
 // Convert (u, v) to (x, y, z) 
 // We assume u,v is in [0, 1]
 //
@@ -297,4 +1496,32 @@ glm::vec3 ViewPlane::toWorld(float u, float v) {
 Ray RenderCam::getRay(float u, float v) {
 	glm::vec3 pointOnPlane = view.toWorld(u, v);
 	return(Ray(position, glm::normalize(pointOnPlane - position)));
+}
+
+// Rays through the centers of the nx x ny pixels at (x0, y0), row major.
+// The same directions as getRay(), but the view plane x of a ray only
+// depends on its column and y only on its row, so those are worked out
+// once per column / row instead of once per ray.
+//
+void RenderCam::getPacket(RayPacket &packet, int x0, int y0, int nx, int ny, int imageWidth, int imageHeight) {
+	float w = view.width();
+	float h = view.height();
+	float columnX[RayPacket::width], rowY[RayPacket::width];
+	for (int i = 0; i < nx; i++) columnX[i] = ((x0 + i + .5f) / imageWidth * w + view.min.x) - position.x;
+	for (int j = 0; j < ny; j++) rowY[j] = ((y0 + j + .5f) / imageHeight * h + view.min.y) - position.y;
+	float z = view.position.z - position.z;
+
+	packet.origin = position;
+	packet.count = nx * ny;
+	for (int k = 0; k < packet.count; k++) {
+		float x = columnX[k % nx];
+		float y = rowY[k / nx];
+		float len = 1.0f / sqrt(x * x + y * y + z * z);
+		packet.dx[k] = x * len;
+		packet.dy[k] = y * len;
+		packet.dz[k] = z * len;
+		packet.invX[k] = slabInverse(packet.dx[k]);
+		packet.invY[k] = slabInverse(packet.dy[k]);
+		packet.invZ[k] = slabInverse(packet.dz[k]);
+	}
 }
\ No newline at end of file
@@ -3,38 +3,151 @@
 #include "ofMain.h"
 #include <glm/gtx/intersect.hpp>
 #include <fstream>
+#include <sstream>
+#include <map>
+#include <random>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include "TilePool.h"
+#include "BVH.h"
+#include "LightTree.h"
+#include "Sampler.h"
+#include "ObjLoader.h"
+#include "ImageSaver.h"
+#include "ScanlineWriter.h"
+#include "RenderJournal.h"
+#include "SceneFile.h"
+#include "TileCoordinator.h"
+#include "Profiler.h"
+#include "Benchmark.h"
 
 class Ray {
 public:
 	Ray(glm::vec3 p, glm::vec3 d) { this->p = p; this->d = d; }
 	void draw(float t) { ofDrawLine(p, p + t * d); }
-	glm::vec3 evalPoint(float t) { return (p + t * d); }
+	glm::vec3 evalPoint(float t) const { return (p + t * d); }
 
 	glm::vec3 p, d;
 };
 
+// 1 / d for the slab tests.  A zero component is nudged to a tiny one of
+// the same sign, so its inverse is huge but finite: an infinite one gives
+// 0 * inf = NaN for a ray that starts on the face of a box.
+//
+inline float slabInverse(float d) {
+	return 1.0f / (abs(d) > 1e-20f ? d : std::copysign(1e-20f, d));
+}
+
+inline glm::vec3 slabInverse(const glm::vec3 &d) {
+	return glm::vec3(slabInverse(d.x), slabInverse(d.y), slabInverse(d.z));
+}
+
+//  Block of up to 8x8 primary rays from one camera position.  Directions
+//  are stored per component so the slab tests in BVH::closestHitPacket()
+//  run across the rays of the block together.
+//
+struct RayPacket {
+	static const int width = 8;
+	static const int size = width * width;
+
+	Ray ray(int i) const { return Ray(origin, glm::vec3(dx[i], dy[i], dz[i])); }
+
+	glm::vec3 origin;
+	int count = 0;                 // rays in use, edge blocks are partial
+	alignas(32) float dx[size], dy[size], dz[size];
+	alignas(32) float invX[size], invY[size], invZ[size];
+};
+
+class SceneObject;
+
+// Shading runs on linear float RGB in [0, 1] per channel; ofColor is only
+// used to describe the scene and for the final 8 bit image.
+//
+inline glm::vec3 toFloatColor(const ofColor &c) {
+	return glm::vec3(c.r, c.g, c.b) / 255.0f;
+}
+
+// Surface properties used to shade a hit
+//
+struct Material {
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float reflectiveness;
+};
+
+// Result of a ray-object query.  intersect() only fills it in for hits
+// closer than the t-max it is given, so the closest hit over the whole
+// scene comes out of one pass with no distance math or second intersect.
+//
+struct HitRecord {
+	float t;
+	glm::vec3 point;
+	glm::vec3 normal;
+	SceneObject *object = NULL;
+	Material material;
+};
+
 class SceneObject {
 public:
+	virtual ~SceneObject() {}
 	virtual void draw() = 0;    // pure virtual funcs - must be overloaded
-	virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { /*cout << "SceneObject::intersect" << endl;*/ return false; }
+	virtual bool intersect(const Ray &ray, float tMax, HitRecord &hit) { /*cout << "SceneObject::intersect" << endl;*/ return false; }
+	// world space bounding box, false if the object is unbounded
+	virtual bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) { return false; }
 	ofColor getDiffuse() { return diffuseColor; }
+	// color of the texture at surface point p, textured objects override this
+	virtual ofColor textureLookup(const glm::vec3 &p) { return diffuseColor; }
+	Material getMaterial(const glm::vec3 &p) {
+		ofColor diffuse = diffuseColor;
+		if (texture) {
+			PROFILE_SCOPE(Profiler::Texture);
+			diffuse = textureLookup(p);
+		}
+		return Material{ toFloatColor(diffuse), toFloatColor(specularColor), reflectiveness };
+	}
 
 	glm::vec3 position = glm::vec3(0, 0, 0);
 	ofColor diffuseColor = ofColor::grey;    // default colors - can be changed.
 	ofColor specularColor = ofColor::lightGray;
 	float reflectiveness = 0;
+	ofImage *texture = NULL;    // optional, CPU only (owned by ofApp)
 };
 
 class Sphere : public SceneObject {
 public:
 	Sphere(glm::vec3 p, float r, ofColor diffuse = ofColor::lightGray) { position = p; radius = r; diffuseColor = diffuse; }
 	Sphere() {}
-	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
-		return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
+	bool intersect(const Ray &ray, float tMax, HitRecord &hit) {
+		// distance only test, the point and normal are only worked out for
+		// hits that beat tMax
+		float t;
+		if (!glm::intersectRaySphere(ray.p, ray.d, position, radius * radius, t) || t >= tMax) return false;
+		hit.t = t;
+		hit.point = ray.evalPoint(t);
+		hit.normal = (hit.point - position) / radius;
+		hit.object = this;
+		return true;
+	}
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax) {
+		bmin = position - glm::vec3(radius);
+		bmax = position + glm::vec3(radius);
+		return true;
 	}
 	void draw() {
 		ofDrawSphere(position, radius);
 	}
+	ofColor textureLookup(const glm::vec3 &p) {
+		// spherical (u, v) of the direction from the center
+		glm::vec3 dir = glm::normalize(p - position);
+		float u = 0.5 + atan2(dir.z, dir.x) / TWO_PI;
+		float v = 0.5 - asin(ofClamp(dir.y, -1, 1)) / PI;
+		int w = texture->getWidth();
+		int h = texture->getHeight();
+		int i = ofClamp(w - u * w - .5, 0, w - 1);
+		int j = ofClamp(v * h - .5, 0, h - 1);
+		return texture->getColor(i, j);
+	}
 	float radius = 1.0;
 };
 
@@ -52,6 +165,32 @@ public:
 };
 
 
+// A plane is clipped to a width x height rectangle around its position.
+// A floor, ceiling or sloped plane is clipped in x and z, so it covers
+// width in x and height in z whatever its slope.  A wall (a normal without
+// a y component) is width long, along the wall, and height tall.  u and v
+// are the directions width and height are measured along.
+//
+inline void planeExtentAxes(const glm::vec3 &normal, glm::vec3 &u, glm::vec3 &v) {
+	if (normal.y != 0) {
+		u = glm::vec3(1, 0, 0);
+		v = glm::vec3(0, 0, 1);
+	}
+	else {
+		u = glm::normalize(glm::cross(glm::vec3(0, 1, 0), normal));
+		v = glm::vec3(0, 1, 0);
+	}
+}
+
+inline bool insidePlaneExtent(const glm::vec3 &point, const glm::vec3 &position, const glm::vec3 &normal, float width, float height) {
+	glm::vec3 u, v;
+	planeExtentAxes(normal, u, v);
+	glm::vec3 d = point - position;
+	return abs(glm::dot(d, u)) < width / 2 && abs(glm::dot(d, v)) < height / 2;
+}
+
+bool planeBounds(const glm::vec3 &position, const glm::vec3 &normal, float width, float height, glm::vec3 &bmin, glm::vec3 &bmax);
+
 class Plane : public SceneObject {
 public:
 	Plane(glm::vec3 p, glm::vec3 n, ofColor diffuse = ofColor::darkOliveGreen, float w = 20, float h = 20) {
@@ -68,9 +207,11 @@ public:
 		normal = glm::vec3(0, 1, 0);
 		plane.rotateDeg(90, 1, 0, 0);
 	}
-	bool intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normal);
+	bool intersect(const Ray &ray, float tMax, HitRecord &hit);
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax);
 	float sdf(const glm::vec3 & p);
 	glm::vec3 getNormal(const glm::vec3 &p) { return this->normal; }
+	ofColor textureLookup(const glm::vec3 &p);
 	void draw() {
 		plane.setPosition(position);
 		plane.setWidth(width);
@@ -83,10 +224,12 @@ public:
 
 	float width = 20;
 	float height = 20;
+	float textureLength = 2.5;    // world size of one repeat of the texture
 };
 
 
-// Too slow, need to stop memory leak to use
+// Mirror bounces are bounded by ofApp::maxReflectionDepth, so mirror rooms
+// built from these render in bounded time
 
 class MirrorPlane : public Plane {
 public:
@@ -106,7 +249,8 @@ public:
 		reflectiveness = 1.0;
 		plane.rotateDeg(90, 1, 0, 0);
 	}
-	bool intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normal);
+	bool intersect(const Ray &ray, float tMax, HitRecord &hit);
+	bool getBounds(glm::vec3 &bmin, glm::vec3 &bmax);
 	float sdf(const glm::vec3 & p);
 	glm::vec3 getNormal(const glm::vec3 &p) { return this->normal; }
 	void draw() {
@@ -159,6 +303,7 @@ public:
 		aim = glm::vec3(0, 0, -1);
 	}
 	Ray getRay(float u, float v);
+	void getPacket(RayPacket &packet, int x0, int y0, int nx, int ny, int imageWidth, int imageHeight);
 	void draw() { ofDrawBox(position, 1.0); };
 	void drawFrustum();
 
@@ -183,34 +328,13 @@ public:
 	AreaLight(glm::vec3 p, float intensity, std::string objshape) {
 		this->position = p;
 		this->intensity = intensity;
-		// go through file and save all vertices to a vector
-		ifstream inStream;
-		inStream.open(objshape);
-		std::string line;
-		while (std::getline(inStream, line)) {
-			if (line.size() > 2) {
-				string frontTwo = line.substr(0, 2);
-
-				if (frontTwo == "v ") {
-					float vx, vy, vz;
-					int spIndex, nextspIndex;
-					std::string temp;
-
-					spIndex = line.find(' ');
-					temp = line.substr(spIndex + 1);
-					nextspIndex = temp.find(' ');
-					vx = std::stof(temp.substr(0, nextspIndex));
-
-					temp = temp.substr(nextspIndex + 1);
-					nextspIndex = temp.find(' ');
-					vy = std::stof(temp.substr(0, nextspIndex));
-
-					vz = std::stof(temp.substr(nextspIndex + 1));
-					// push back the 3d point of each vertex plus the offset
-					verts.push_back(glm::vec3(vx + p.x, vy + p.y, vz + p.z));
-				}
-			}
-		}
+		// load the emitter shape and move its vertices to the light position
+		ObjMesh mesh;
+		if (!loadObj(objshape, mesh)) cout << "AreaLight: can't read " << objshape << endl;
+		verts.swap(mesh.verts);
+		for (glm::vec3 &v : verts) v += p;
+		tris.swap(mesh.tris);
+		buildAreaCdf();
 	}
 	void draw() {
 		for (glm::vec3 a : verts) {
@@ -218,8 +342,122 @@ public:
 		}
 	};
 
+	// uniformly distributed point on the emitter surface for a sample u in
+	// [0, 1)^2.  u.x picks a triangle by area and is then rescaled to be
+	// reused with u.y as the position inside that triangle.  An OBJ without
+	// faces falls back to picking one of its vertices, and one without
+	// vertices to the light position.
+	//
+	glm::vec3 samplePoint(glm::vec2 u) const {
+		if (verts.empty()) return position;
+		if (areaCdf.empty()) {
+			int n = verts.size();
+			return verts[std::min(int(u.x * n), n - 1)];
+		}
+		int tri = std::upper_bound(areaCdf.begin(), areaCdf.end(), u.x) - areaCdf.begin();
+		tri = std::min(tri, (int)areaCdf.size() - 1);
+		float lo = tri > 0 ? areaCdf[tri - 1] : 0;
+		float su = glm::clamp((u.x - lo) / (areaCdf[tri] - lo), 0.0f, 1.0f);
+
+		float s = sqrt(su);
+		float b0 = 1 - s;
+		float b1 = u.y * s;
+		const glm::vec3 &a = verts[tris[3 * tri]];
+		const glm::vec3 &b = verts[tris[3 * tri + 1]];
+		const glm::vec3 &c = verts[tris[3 * tri + 2]];
+		return b0 * a + b1 * b + (1 - b0 - b1) * c;
+	}
+
 	float intensity;
+	float area = 0;
 	std::vector < glm::vec3 > verts;
+	std::vector < int > tris;         // 3 vertex indices per triangle
+	std::vector < float > areaCdf;    // running triangle area / total area
+
+private:
+	void buildAreaCdf() {
+		areaCdf.clear();
+		area = 0;
+		for (size_t t = 0; t + 2 < tris.size(); t += 3) {
+			glm::vec3 e1 = verts[tris[t + 1]] - verts[tris[t]];
+			glm::vec3 e2 = verts[tris[t + 2]] - verts[tris[t]];
+			area += 0.5f * glm::length(glm::cross(e1, e2));
+			areaCdf.push_back(area);
+		}
+		if (area <= 0) { areaCdf.clear(); return; }
+		for (float &c : areaCdf) c /= area;
+	}
+};
+
+// Light samples of one shading point as a structure of arrays, padded to a
+// multiple of lanes so the shading loop over them has no remainder code.
+//
+struct LightSamples {
+	static const int lanes = 8;
+	std::vector < float > x, y, z;
+	std::vector < float > visible;     // 0 if the shadow ray was blocked, else 1 - or the light's
+	                                   // intensity over its pick probability with the light tree
+	std::vector < float > weight;      // scratch for the specular pass
+	std::vector < float > cosH;
+
+	void reserve(int n) {
+		int padded = (n + lanes - 1) / lanes * lanes;
+		if ((int)x.size() >= padded) return;
+		x.resize(padded); y.resize(padded); z.resize(padded);
+		visible.resize(padded);
+		weight.resize(padded); cosH.resize(padded);
+	}
+};
+
+// One light sample chosen out of a stream of candidates by weighted
+// reservoir sampling (ofApp::resampleTile).  update() keeps each candidate
+// with probability proportional to its weight, so the reservoir needs no
+// memory for the ones it drops; wSum and m are what's left to weight the
+// sample it kept.
+//
+struct LightReservoir {
+	glm::vec3 y;           // point on lights[light], -1 while no candidate had weight
+	int light = -1;
+	float wSum = 0;        // candidate weights
+	float W = 0;           // weight of y in the estimate, wSum / (m * target(y)), 0 if it's in shadow
+	int m = 0;             // candidates seen
+
+	void update(const glm::vec3 &x, int l, float w, float u) {
+		wSum += w;
+		if (w > 0 && u * wSum < w) {
+			y = x;
+			light = l;
+		}
+	}
+};
+
+// per pixel sample statistics of the tile a worker is on (ofApp::traceTile)
+//
+struct TileSamples {
+	std::vector < glm::vec3 > sum;     // color sum, the mean once the tile is done
+	std::vector < float > lum, lumSq;  // sums of the clamped brightness and its square
+	std::vector < int > count;
+	std::vector < char > refine;
+
+	// the pixels of a resampleTile() pass and what it found for them
+	std::vector < char > active;
+	std::vector < HitRecord > hits;
+	std::vector < glm::vec3 > dirs;    // primary ray directions
+	std::vector < LightReservoir > reservoirs;
+	std::vector < glm::vec3 > color;
+};
+
+// Per-thread scratch state for shading.  Each render worker owns one of these
+// so tiles can be traced in parallel without writing to shared ofApp members.
+//
+struct ShadeContext {
+	glm::vec3 v, l, n;
+	glm::vec3 meshPt;
+	float totalIntensity;
+	Sampler sampler;         // restarted for every pixel
+	LightSamples samples;    // reused by every phong() call on this worker
+	int64_t rays = 0;        // primary, shadow and reflected rays traced by this worker
+	TileSamples tile;
 };
 
 class ofApp : public ofBaseApp {
@@ -228,6 +466,7 @@ public:
 	void setup();
 	void update();
 	void draw();
+	void exit();
 
 	void keyPressed(int key);
 	void keyReleased(int key);
@@ -240,9 +479,34 @@ public:
 	void windowResized(int w, int h);
 	void dragEvent(ofDragInfo dragInfo);
 	void gotMessage(ofMessage msg);
+	void buildDefaultScene();
+	bool loadSceneFile(const std::string &file, std::string &error);
+	void clearScene();
+	ofImage *cachedTexture(const std::string &path);
 	void rayTrace();
-	ofColor ofApp::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, const float reflectiveness, float power);
-	bool inShadow(Ray r);
+	void renderHeadless();
+	void runBenchmark();
+	void rayTraceDistributed();
+	int renderWorker();
+	void serveRenderJobs();
+	std::string runRenderJob(const std::string &command, bool &quit);
+	void prepareRender();
+	void allocateFrame();
+	void rayTraceStreamed();
+	uint64_t renderSettingsKey();
+	void startProgressiveRender();
+	void progressiveTrace();
+	void renderTile(const Tile &tile, ShadeContext &ctx, int pass, int step);
+	glm::vec3 tracePixel(ShadeContext &ctx, float u, float v);
+	void traceBlock(ShadeContext &ctx, int x0, int y0, int nx, int ny, glm::vec3 *colors);
+	void renderTileAdaptive(const Tile &tile, ShadeContext &ctx);
+	void traceTile(const Tile &tile, ShadeContext &ctx);
+	void resampleTile(const Tile &tile, ShadeContext &ctx);
+	glm::vec3 primaryColor(ShadeContext &ctx, const Ray &ray, const HitRecord &hit);
+	ofColor toneMap(const glm::vec3 &c);
+	glm::vec3 shade(ShadeContext &ctx, const Ray &primary, const HitRecord &primaryHit);
+	glm::vec3 phong(ShadeContext &ctx, const HitRecord &hit, const glm::vec3 &v, float power);
+	bool inShadow(const glm::vec3 &p, const glm::vec3 &n, const glm::vec3 &x);
 
 	ofEasyCam mainCam;
 	RenderCam renderCam;
@@ -252,17 +516,78 @@ public:
 
 	std::vector < SceneObject* > scene;
 	std::vector < AreaLight* > lights;
+	struct CachedTexture {
+		ofImage *image = NULL;
+		int64_t stamp = 0;        // file modification time when loaded
+	};
+	std::map < std::string, CachedTexture > textureCache;   // by path, outlives the scene
+	std::string sceneFile;   // .scene / .scenebin to load in setup(), empty for the built-in mirror room
+	uint64_t sceneKey = 0;   // SceneDesc::hash() of the loaded scene file
+	BVH bvh;                 // built over scene at the start of the first render after it changes
+	int sceneVersion = 0;    // bumped whenever scene is replaced
+	int bvhVersion = -1;     // sceneVersion bvh and lightTree were built for
+	LightTree lightTree;     // over lights, used once there are lightTreeMinLights of them
 
 	ofImage image;
-	glm::vec3 intersectPt;
-	glm::vec3 intersectNorm;
-	glm::vec3 v, l, h, n;
-	glm::vec3 meshPt;
-	Ray *reflectRay;
-	float pointIntensity, totalIntensity;
+	ImageSaver imageSaver;   // encodes finished frames in the background
 	ofColor ambient = ofColor(40, 40, 40);
 	ofColor reflColor;
-	int samplePts = 100;
+	int samplePts = 100;      // shadow ray budget per light for penumbra points
+	int shadowBatch = 8;      // first shadow rays per light, more only if they disagree
+	int lightTreeMinLights = 8;   // from this many lights on, sample them through lightTree
+	int lightTreeSamples = 32;    // shadow rays per shading point shared by all the lights then
+	int maxReflectionDepth = 8;       // mirror bounces followed per primary ray
+
+	// adaptive anti-aliasing of rayTrace() (see traceTile), 1 max sample = off
+	int adaptiveMinSamples = 4;       // every pixel
+	int adaptiveMaxSamples = 16;      // pixels on edges and in penumbrae
+	int adaptiveStep = 4;             // samples added to an unresolved pixel per round
+	float adaptiveThreshold = .01;    // standard error of the pixel brightness (0..1) to stop at
+	float adaptiveContrast = .1;      // brightness step to a neighbor that marks an edge
+	float minThroughput = 1.0 / 255;  // stop once a bounce can't change the pixel
+
+	// light samples shared between neighboring pixels in place of phong()'s
+	// shadow rays on surfaces that aren't mirrors (see resampleTile)
+	bool reservoirSampling = false;
+	int reservoirCandidates = 32;     // unshadowed light samples streamed through each pixel's reservoir
+	int reservoirNeighbors = 4;       // reservoirs of other pixels merged into each
+	int reservoirRadius = 8;          // in pixels, within the tile
+
+	int numThreads = 0;      // render workers, 0 = one per hardware thread
+	int tileSize = 32;       // tile edge in pixels
+	ofColor backgroundColor;
+	float exposure = 1.0;    // applied once when the float image is quantized
+	bool streamOutput = false;  // rayTrace() streams bands to path (.ppm/.bmp) instead of keeping the frame
+
+	// rayTrace() journals finished tiles next to path and resumes from them
+	bool checkpointing = true;
+	float checkpointInterval = 60;    // seconds between full frame checkpoints
+	RenderJournal journal;
+
+	// progressive rendering (F3)
+	int progressivePasses = 16;       // samples per pixel when the render finishes
+	int coarseStep = 8;               // block size of the first preview pass, power of 2
+	std::vector < glm::vec3 > accum;  // float framebuffer, running sum of the samples of each pixel
+	std::thread renderThread;
+	std::atomic<bool> rendering{ false };
+	std::atomic<bool> cancelRender{ false };
+	std::atomic<bool> previewDirty{ false };
+	std::atomic<int> renderPass{ 0 };
+	bool renderStarted = false;
+
+	bool headless = false;            // command line batch render, no window (see main.cpp)
+	std::string profileOutput;        // headless: Chrome trace of the render (RT_PROFILE builds only)
+	std::string benchOutput;          // headless: run the benchmarks and write their results here
+	int64_t raysTraced = 0;           // by the last rayTrace(), all rays
+
+	// distributed rendering (headless only, see TileCoordinator.h)
+	int servePort = 0;                // > 0: coordinate workers on this port instead of tracing
+	std::string coordinatorHost;      // not empty: run as a worker for this coordinator
+	int coordinatorPort = 0;
+	int distributedTileSize = 128;    // tile edge handed to one worker at a time
+	float workerTimeout = 60;         // seconds without a heartbeat before a worker's tile is reassigned
+
+	int daemonPort = 0;               // > 0: headless render daemon on this local port
 
 
 	int imageWidth = 3000;
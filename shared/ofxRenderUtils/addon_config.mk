@@ -0,0 +1,13 @@
+# Code shared by the apps in this repository: the --bench timer (Benchmark)
+# and the background image writer (ImageSaver).  Each app lists this folder
+# in its addons.make, so the project generator and the makefiles compile
+# src/ into the app and put it on the include path.
+
+meta:
+	ADDON_NAME = ofxRenderUtils
+	ADDON_DESCRIPTION = Benchmark and ImageSaver, shared by the apps of this repository
+	ADDON_AUTHOR =
+	ADDON_TAGS =
+	ADDON_URL =
+
+common:
@@ -0,0 +1,88 @@
+#include "Benchmark.h"
+
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+
+// s as a quoted JSON string.  Names come from scene paths on the command
+// line, which may hold backslashes or quotes.
+//
+static std::string jsonString(const std::string &s) {
+	std::string out = "\"";
+	for (unsigned char c : s) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}
+		else if (c < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			out += escape;
+		}
+		else out += c;
+	}
+	return out + "\"";
+}
+
+void Benchmark::addKernel(const std::string &name, bool rays, int64_t calls, double seconds) {
+	Result result;
+	result.name = name;
+	result.rays = rays;
+	result.calls = calls;
+	result.seconds = seconds;
+	results.push_back(result);
+}
+
+void Benchmark::scene(const std::string &name, int width, int height, int threads, int64_t rays, const Stages &stages) {
+	Result result;
+	result.name = name;
+	result.scene = true;
+	result.rays = true;
+	result.calls = rays;
+	result.width = width;
+	result.height = height;
+	result.threads = threads;
+	result.stages = stages;
+	for (auto &stage : stages) {
+		if (stage.first == "trace") result.seconds = stage.second;
+	}
+	results.push_back(result);
+}
+
+bool Benchmark::write(const std::string &path) {
+	std::cout << std::left << std::setw(32) << "benchmark" << std::right << std::setw(14) << "ns / call"
+		<< std::setw(12) << "Mrays/s" << std::endl;
+	for (const Result &r : results) {
+		std::cout << std::left << std::setw(32) << r.name << std::right << std::fixed << std::setprecision(2);
+		if (r.scene) std::cout << std::setw(14) << "-";
+		else std::cout << std::setw(14) << r.seconds * 1e9 / r.calls;
+		if (r.rays) std::cout << std::setw(12) << r.calls / r.seconds / 1e6;
+		std::cout << std::endl;
+	}
+	std::cout << std::defaultfloat;
+
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f) return false;
+	fprintf(f, "{ \"app\": %s, \"seed\": %u, \"results\": [", jsonString(app).c_str(), seed);
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		fprintf(f, "%s\n  { \"name\": %s, \"kind\": \"%s\", ", i ? "," : "", jsonString(r.name).c_str(), r.scene ? "scene" : "kernel");
+		if (r.scene) {
+			fprintf(f, "\"width\": %d, \"height\": %d, \"threads\": %d, \"rays\": %lld, ",
+				r.width, r.height, r.threads, (long long)r.calls);
+		}
+		else fprintf(f, "\"calls\": %lld, \"ns_per_call\": %.3f, ", (long long)r.calls, r.seconds * 1e9 / r.calls);
+		fprintf(f, "\"seconds\": %.6f", r.seconds);
+		if (r.rays && r.seconds > 0) fprintf(f, ", \"mrays_per_s\": %.3f", r.calls / r.seconds / 1e6);    // JSON has no inf
+		if (r.scene) {
+			fprintf(f, ", \"stages\": {");
+			for (size_t s = 0; s < r.stages.size(); s++) {
+				fprintf(f, "%s %s: %.6f", s ? "," : "", jsonString(r.stages[s].first).c_str(), r.stages[s].second);
+			}
+			fprintf(f, " }");
+		}
+		fprintf(f, " }");
+	}
+	fprintf(f, "\n] }\n");
+	return fclose(f) == 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+//  Timings for the --bench mode, written as one JSON document so runs of
+//  different builds can be compared by a script:
+//
+//    { "app": "ray-tracer", "seed": 1, "results": [
+//      { "name": "Sphere::intersect", "kind": "kernel", "calls": 9175040,
+//        "seconds": 0.5, "ns_per_call": 54.5, "mrays_per_s": 18.35 },
+//      { "name": "mirror-room", "kind": "scene", "width": 600, "height": 400,
+//        "threads": 8, "rays": 31040412, "seconds": 2.1, "mrays_per_s": 14.8,
+//        "stages": { "bvh": 0.0001, "trace": 2.0, "save": 0.1 } } ] }
+//
+//  Kernels run over a fixed set of inputs made from a fixed seed, again and
+//  again until minSeconds have passed.  mrays_per_s is left out for kernels
+//  that don't trace a ray per call.
+//
+class Benchmark {
+public:
+	typedef std::vector < std::pair < std::string, double > > Stages;    // name, seconds
+
+	Benchmark(const std::string &app) : app(app) {}
+
+	// time f(i) for i in [0, inputs).  f returns a number made from its
+	// result so the call can't be optimized away.
+	//
+	template <class F> void kernel(const std::string &name, bool rays, int inputs, F f) {
+		double sum = 0;
+		for (int i = 0; i < inputs; i++) sum += f(i);    // warm up caches and branch predictors
+		int64_t calls = 0;
+		double seconds = 0;
+		auto start = std::chrono::steady_clock::now();
+		while (seconds < minSeconds) {
+			for (int i = 0; i < inputs; i++) sum += f(i);
+			calls += inputs;
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		sink = sink + sum;
+		addKernel(name, rays, calls, seconds);
+	}
+
+	// an end to end render that traced rays rays, with the seconds each
+	// stage took.  rays / the "trace" stage gives its Mrays/s.
+	//
+	void scene(const std::string &name, int width, int height, int threads, int64_t rays, const Stages &stages);
+
+	// write the results to path, and a table of them to cout.  returns
+	// false if path can't be written.
+	//
+	bool write(const std::string &path);
+
+	double minSeconds = .5;
+	static const unsigned seed = 1;    // for the kernel inputs
+
+private:
+	struct Result {
+		std::string name;
+		bool scene = false;
+		bool rays = false;
+		int64_t calls = 0;     // kernel calls or scene rays
+		double seconds = 0;
+		int width = 0, height = 0, threads = 0;
+		Stages stages;
+	};
+
+	void addKernel(const std::string &name, bool rays, int64_t calls, double seconds);
+
+	std::string app;
+	std::vector < Result > results;
+	volatile double sink = 0;
+};
@@ -0,0 +1,82 @@
+#include "ImageSaver.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+int64_t nowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+ImageSaver::ImageSaver(int maxQueued) {
+	this->maxQueued = std::max(maxQueued, 1);
+	worker = std::thread(&ImageSaver::run, this);
+}
+
+ImageSaver::~ImageSaver() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	changed.notify_all();
+	worker.join();
+}
+
+void ImageSaver::save(const ofPixels &pixels, const filesystem::path &path, ofImageQualityType quality) {
+	// copy outside the lock, the render buffer can be reused once we return
+	Job job;
+	job.pixels = pixels;
+	job.path = path;
+	job.quality = quality;
+
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this] { return (int)jobs.size() < maxQueued; });
+	jobs.push_back(std::move(job));
+	changed.notify_all();
+}
+
+void ImageSaver::waitIdle() {
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this] { return jobs.empty() && !busy; });
+}
+
+void ImageSaver::run() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		changed.wait(guard, [this] { return quit || !jobs.empty(); });
+		if (jobs.empty()) return;     // quit, and nothing left to write
+
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		busy = true;
+		changed.notify_all();          // a queue slot is free
+
+		guard.unlock();
+		int64_t start = nowNs();
+		bool ok;
+		if (job.path.extension() == ".ppm") ok = writePPM(job.pixels, job.path);
+		else ok = ofSaveImage(job.pixels, job.path, job.quality);
+		if (!ok) cout << "ImageSaver: failed to write " << job.path << endl;
+		if (onWritten) onWritten(start, nowNs());
+		guard.lock();
+
+		busy = false;
+		changed.notify_all();
+	}
+}
+
+// binary PPM: a short text header followed by the raw RGB bytes
+//
+bool ImageSaver::writePPM(const ofPixels &pixels, const filesystem::path &path) {
+	if (pixels.getNumChannels() != 3) return false;
+	FILE *f = fopen(ofToDataPath(path.string()).c_str(), "wb");
+	if (!f) return false;
+	fprintf(f, "P6\n%d %d\n255\n", (int)pixels.getWidth(), (int)pixels.getHeight());
+	size_t bytes = pixels.getWidth() * pixels.getHeight() * 3;
+	bool ok = fwrite(pixels.getData(), 1, bytes, f) == bytes;
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ofMain.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//  Encodes and writes finished frames on a background thread, so the next
+//  frame can start rendering while the previous one is being compressed.
+//  At most maxQueued frames wait for the encoder; save() blocks beyond that,
+//  which bounds the memory held by frames in flight.
+//
+//  The format follows the file extension.  .png/.jpg/.bmp/.tga go through
+//  ofSaveImage (bmp and tga are uncompressed, so much faster than png);
+//  .ppm is written directly as raw binary RGB, the fastest option.
+//
+class ImageSaver {
+public:
+	ImageSaver(int maxQueued = 2);
+	~ImageSaver();              // writes any frames still queued
+
+	// queue a copy of pixels to be written to path
+	//
+	void save(const ofPixels &pixels, const filesystem::path &path, ofImageQualityType quality = OF_IMAGE_QUALITY_BEST);
+
+	// block until every queued frame is on disk
+	//
+	void waitIdle();
+
+	// called on the encoder thread after every write with when it started
+	// and ended (steady_clock nanoseconds), e.g. to profile saving.  Set it
+	// before the first save().
+	//
+	std::function<void(int64_t startNs, int64_t endNs)> onWritten;
+
+private:
+	struct Job {
+		ofPixels pixels;
+		filesystem::path path;
+		ofImageQualityType quality;
+	};
+
+	void run();
+	static bool writePPM(const ofPixels &pixels, const filesystem::path &path);
+
+	int maxQueued;
+	std::deque<Job> jobs;
+	bool busy = false;
+	bool quit = false;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::thread worker;
+};
@@ -1,8 +1,46 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "Benchmark.h"
+#include <random>
+
+// --bench <json>: time Box::intersect on seeded random rays, write the
+// results to json (relative to the data folder, as in the other apps) and
+// exit without opening a window
+//
+static int runBenchmark(const std::string &output) {
+	Benchmark bench("skeleton-joints");
+	std::mt19937 rng(Benchmark::seed);
+	std::uniform_real_distribution<float> spread(-1, 1);
+
+	// rays from a sphere of radius 10 towards the unit box, about half hit
+	const int inputs = 4096;
+	std::vector < _Ray > rays;
+	for (int i = 0; i < inputs; i++) {
+		Vector3 from(spread(rng), spread(rng), spread(rng));
+		from.normalize();
+		from = from * 10;
+		Vector3 to(2 * spread(rng), 2 * spread(rng), 2 * spread(rng));
+		Vector3 dir = to - from;
+		dir.normalize();
+		rays.push_back(_Ray(from, dir));
+	}
+	Box box(Vector3(-1, -1, -1), Vector3(1, 1, 1));
+	bench.kernel("Box::intersect", true, inputs, [&](int i) { return (float)box.intersect(rays[i], 0, FLT_MAX); });
+
+	if (!bench.write(ofToDataPath(output))) {
+		cout << "can't write " << output << endl;
+		return 1;
+	}
+	return 0;
+}
 
 //========================================================================
-int main( ){
+int main(int argc, char *argv[]){
+	if (argc == 3 && std::string(argv[1]) == "--bench") return runBenchmark(argv[2]);
+	if (argc > 1) {
+		cout << "usage: " << argv[0] << " [--bench <json>]" << endl;
+		return 1;
+	}
 	ofSetupOpenGL(1200,800,OF_WINDOW);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
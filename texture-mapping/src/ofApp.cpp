@@ -19,7 +19,11 @@ void ofApp::setup() {
 	secondLightCam.setPosition(lights[1]->position);
 	secondLightCam.lookAt(glm::vec3(0, 0, 0));
 
+	// there is no GL context to upload to when headless
+	if (headless) image.setUseTexture(false);
 	image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+
+	if (headless) renderHeadless();
 }
 
 //--------------------------------------------------------------
@@ -154,7 +158,7 @@ void ofApp::rayTrace() {
 		}
 	
 	}
-	image.save(path, OF_IMAGE_QUALITY_BEST);
+	imageSaver.save(image.getPixels(), path);
 }
 
 void ofApp::rmRayTrace() {
@@ -179,7 +183,86 @@ void ofApp::rmRayTrace() {
 			cout << ".";
 		}
 	}
-	image.save(path, OF_IMAGE_QUALITY_BEST);
+	imageSaver.save(image.getPixels(), path);
+}
+
+// Command line render: trace or march the frame, wait until it is on disk
+// and quit
+//
+void ofApp::renderHeadless() {
+	if (!benchOutput.empty()) {
+		runBenchmark();
+		ofExit(0);
+		return;
+	}
+	cout << (rayMarched ? "ray marching " : "ray tracing ") << imageWidth << "x" << imageHeight << " -> " << path << endl;
+
+	float start = ofGetElapsedTimef();
+	if (rayMarched) rmRayTrace();
+	else rayTrace();
+	float rendered = ofGetElapsedTimef();
+	imageSaver.waitIdle();
+	float saved = ofGetElapsedTimef();
+
+	cout << endl << "render: " << rendered - start << "s, save: " << saved - rendered << "s, total: " << saved - start << "s" << endl;
+	ofExit(0);
+}
+
+// --bench: time the intersect, sdf() and textureLookup() kernels on seeded
+// random inputs, then ray trace and ray march the textured scene at a fixed
+// size.  The scenes' rays are the primary rays, one per pixel.
+//
+void ofApp::runBenchmark() {
+	Benchmark bench("texture-mapping");
+	std::mt19937 rng(Benchmark::seed);
+	std::uniform_real_distribution<float> spread(-1, 1);
+
+	const int inputs = 4096;
+	std::vector < glm::vec3 > points, spherePoints, floorPoints;
+	std::vector < Ray > rays;
+	for (int i = 0; i < inputs; i++) {
+		points.push_back(5.0f * glm::vec3(spread(rng), spread(rng), spread(rng)));
+		spherePoints.push_back(sOne.position + sOne.radius * glm::normalize(glm::vec3(spread(rng), spread(rng), spread(rng)) + glm::vec3(0, 0, .01)));
+		floorPoints.push_back(glm::vec3(10 * spread(rng), floorPlane.position.y, 10 * spread(rng)));
+		rays.push_back(renderCam.getRay(.5f + .5f * spread(rng), .5f + .5f * spread(rng)));
+	}
+
+	bench.kernel("Sphere::intersect", true, inputs, [&](int i) {
+		glm::vec3 p, n;
+		return sOne.intersect(rays[i], p, n) ? p.z : 0.0f;
+	});
+	bench.kernel("Plane::intersect", true, inputs, [&](int i) {
+		glm::vec3 p, n;
+		return floorPlane.intersect(rays[i], p, n) ? p.z : 0.0f;
+	});
+	bench.kernel("Sphere::sdf", false, inputs, [&](int i) { return sOne.sdf(points[i]); });
+	bench.kernel("Torus::sdf", false, inputs, [&](int i) { return tOne.sdf(points[i]); });
+	bench.kernel("Box::sdf", false, inputs, [&](int i) { return lOne.sdf(points[i]); });
+	bench.kernel("Plane::sdf", false, inputs, [&](int i) { return floorPlane.sdf(points[i]); });
+	// the textures come from the data folder, skip lookups into a missing one
+	if (sOne.texture.isAllocated()) {
+		bench.kernel("Sphere::textureLookup", false, inputs, [&](int i) { return (float)sOne.textureLookup(spherePoints[i]).r; });
+	}
+	if (floorPlane.texture.isAllocated()) {
+		bench.kernel("Plane::textureLookup", false, inputs, [&](int i) { return (float)floorPlane.textureLookup(floorPoints[i]).r; });
+	}
+
+	imageWidth = 600;
+	imageHeight = 400;
+	image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+	for (int marched = 0; marched < 2; marched++) {
+		float start = ofGetElapsedTimef();
+		if (marched) rmRayTrace();
+		else rayTrace();
+		float rendered = ofGetElapsedTimef();
+		imageSaver.waitIdle();
+		float saved = ofGetElapsedTimef();
+		bench.scene(marched ? "textured (ray marched)" : "textured", imageWidth, imageHeight, 1, int64_t(imageWidth) * imageHeight,
+			{ { "trace", rendered - start }, { "save", saved - rendered } });
+	}
+	cout << endl;
+
+	if (!bench.write(ofToDataPath(benchOutput))) cout << "can't write " << benchOutput << endl;
 }
 
 ofColor ofApp::lambert(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse) {
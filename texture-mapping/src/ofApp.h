@@ -3,6 +3,9 @@
 #include "ofMain.h"
 #include <glm/gtx/intersect.hpp>
 #include <algorithm>
+#include "ImageSaver.h"
+#include "Benchmark.h"
+#include <random>
 
 //  General Purpose Ray class 
 //
@@ -41,7 +44,13 @@ public:
 class Sphere : public SceneObject {
 
 public:
-	Sphere(glm::vec3 p, float r, filesystem::path t, ofColor diffuse = ofColor::lightGray) { position = p; radius = r; diffuseColor = diffuse; texture.load(t); }
+	Sphere(glm::vec3 p, float r, filesystem::path t, ofColor diffuse = ofColor::lightGray) {
+		position = p; radius = r; diffuseColor = diffuse;
+		// only read on the CPU by textureLookup(), so no GL texture - this
+		// also lets the app load with no GL context (headless)
+		texture.setUseTexture(false);
+		texture.load(t);
+	}
 	Sphere() {}
 	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
 		return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
@@ -150,6 +159,7 @@ public:
 		height = h;
 		diffuseColor = diffuse;
 		if (normal == glm::vec3(0, 1, 0)) plane.rotateDeg(90, 1, 0, 0);
+		texture.setUseTexture(false);     // CPU lookups only, see Sphere
 		texture.load("images/texture2.jpg");
 	}
 	Plane() {
@@ -290,6 +300,8 @@ public:
 	void gotMessage(ofMessage msg);
 	void rayTrace();
 	void rmRayTrace();
+	void renderHeadless();
+	void runBenchmark();
 	void drawGrid();
 	void drawAxis(glm::vec3 position);
 	ofColor ofApp::lambert(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse);
@@ -332,6 +344,7 @@ public:
 	Light* lights[3] = { &light1, &light2, &light3 };
 
 	ofImage image;
+	ImageSaver imageSaver;   // encodes finished frames in the background
 	ofImage texture1;
 	glm::vec3 intersectPt;
 	glm::vec3 intersectNorm;
@@ -344,8 +357,12 @@ public:
 	glm::vec3 point, rmNormal;
 
 
+	bool headless = false;     // command line batch render, no window (see main.cpp)
+	bool rayMarched = false;   // headless render uses rmRayTrace() instead of rayTrace()
+	std::string benchOutput;   // headless: run the benchmarks and write their results here
+
 	int imageWidth = 1200;
 	int imageHeight = 800;
-	filesystem::path path = "C:/Users/gregv/Documents/of_v0.11.2_vs2017_release/apps/myApps/BProject2/src/images/image1.png";
+	filesystem::path path = "images/image1.png";    // relative to the data folder
 };
 